@@ -0,0 +1,12 @@
+cd ./xasm
+g++ -o xasm -g utility.cpp instruction_set.cpp lexer.cpp xasm.cpp main.cpp
+mv xasm ../test/
+
+cd ../xcomplier
+g++ -o xcomplier -g  main.cpp xcomplier.cpp parser.cpp lexer.cpp i_code.cpp code_emit.cpp
+mv xcomplier ../test/
+
+cd ../test
+g++ -o bench_strings -O2 -fpermissive -pthread bench_strings.cpp ../xvm/xvm.cpp ../xvm/xvm_jit.cpp -lrt
+./xcomplier bench_strings.xss > /dev/null
+./bench_strings bench_strings.xss.XSE
@@ -45,6 +45,26 @@ enum INSTRUCTION_CODE
 
     INSTR_PAUSE,
     INSTR_EXIT,
+
+    //superinstructions. the assembler never emits these, the VM fuses the sequences the compiler
+    //generates for expressions into them at load time. only the first instruction of a sequence
+    //is rewritten, the rest stays in place and still supplies the operands
+    INSTR_PUSH_POP,//Push X; Pop Y
+    INSTR_PUSH_PAIR,//Push A; Push B; Pop _T1; Pop _T0
+    INSTR_CMP_PUSH,//Push A; Push B; Pop _T1; Pop _T0; Jcc _T0, _T1, L0; Push 0; Jmp L1; L0: Push 1
+    INSTR_CMP_BRANCH,//INSTR_CMP_PUSH followed by L1: Pop X; JE X, 0, L2
+};
+
+#define     INSTR_SUPER_FIRST       INSTR_PUSH_POP
+#define     INSTR_SUPER_LAST        INSTR_CMP_BRANCH
+
+//number of instructions each superinstruction replaces, indexed by opcode - INSTR_SUPER_FIRST
+static const int SUPER_INSTRUCTION_LENGTH[INSTR_SUPER_LAST - INSTR_SUPER_FIRST + 1] =
+{
+    2,
+    4,
+    8,
+    10
 };
 
 static char INSTRUCTION_DESCRIPTION[INSTR_EXIT + 1][10] = 
@@ -116,6 +136,8 @@ enum OP_TYPE
     OP_TYPE_REG, //Register
 
     OP_TYPE_STACK_BASE_MARKER,//marks a stack base
+    OP_TYPE_STACK_FRAME_MARKER,//marks a function's frame record
+    OP_TYPE_STRING_BUILDER,//string under construction by CONCAT(runtime only)
 };
 
 }//xscript
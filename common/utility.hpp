@@ -16,6 +16,24 @@ inline unsigned long get_tick_count()
     return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
 }
 
+inline void sleep_ms(int ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000l;
+    nanosleep(&ts, NULL);
+}
+
+inline unsigned long long get_tick_count_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ts.tv_sec * 1000000ull + ts.tv_nsec / 1000);
+}
+
 inline char* string_to_upper(char* str)
 {
     char* ptr = str;
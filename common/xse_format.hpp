@@ -0,0 +1,150 @@
+#ifndef     __XSCRIPT_XSE_FORMAT_HPP__
+#define     __XSCRIPT_XSE_FORMAT_HPP__
+
+#include <stddef.h>
+
+namespace xscript {
+
+//XSE v2 executable layout, written by xasm and read by xvm.
+//the file starts with an xse2_header and its section table, every section starts on an
+//XSE2_SECTION_ALIGNMENT boundary and holds fixed-width records, so a loader can find and check
+//any section without parsing what comes before it and use the records straight from a mapping.
+//all values are little-endian
+#define     XSE2_ID_STRING              "XSE2"
+#define     XSE2_MAJOR_VERSION          2
+#define     XSE2_MINOR_VERSION          1
+#define     XSE2_SECTION_ALIGNMENT      8
+#define     XSE2_MAX_OPERAND_COUNT      3
+
+enum XSE2_SECTION_TYPE
+{
+    XSE2_SECTION_CODE = 0,//xse2_instruction per instruction
+    XSE2_SECTION_STRING_OFFSETS,//unsigned int per string plus one, offsets into the string data
+    XSE2_SECTION_STRING_DATA,//every string back to back, each one followed by a null terminator
+    XSE2_SECTION_FUNCTIONS,//xse2_function per function
+    XSE2_SECTION_HOST_APIS,//int per host API, the string index of its name
+    XSE2_SECTION_STACK_DEPTHS,//since 2.1, xse2_stack_depth per function followed by one for the whole program
+
+    XSE2_SECTION_COUNT
+};
+
+//2.0 executables only have the sections before this one, the ones after it are optional
+#define     XSE2_REQUIRED_SECTION_COUNT XSE2_SECTION_STACK_DEPTHS
+
+//a host call may carry the number of values it takes off the stack as a second(int) operand,
+//the assembler can only work out the stack depths of functions whose host calls all do
+#define     XSE2_STACK_DEPTH_UNKNOWN    -1
+
+struct xse2_header
+{
+    char id[4];//XSE2_ID_STRING
+    unsigned char major_version;
+    unsigned char minor_version;
+    unsigned short section_count;
+    int stack_size;
+    int global_data_size;
+    int is_main_function_present;
+    int main_function_index;
+    int priority_type;
+    int timeslice_duration;
+    int string_literal_count;//the first strings are the script's literals, function and host API names follow
+    unsigned int crc;//CRC-32 of the header(with this field zeroed) and the section table
+};
+
+struct xse2_section
+{
+    unsigned int type;//XSE2_SECTION_TYPE
+    unsigned int offset;//from the start of the file
+    unsigned int size;//in bytes, without the padding up to the next section
+    unsigned int count;//number of records
+    unsigned int crc;//CRC-32 of the section's bytes
+};
+
+struct xse2_operand
+{
+    int type;//OP_TYPE
+    union
+    {
+        int int_literal;
+        float float_literal;
+        int index;//string, stack, instruction, function, host API or register index
+    };
+    int offset_index;//only used by OP_TYPE_REL_STACK_INDEX
+};
+
+struct xse2_instruction
+{
+    unsigned short opcode;
+    unsigned char opcount;
+    unsigned char reserved;
+    xse2_operand oplist[XSE2_MAX_OPERAND_COUNT];//unused operands are zeroed
+};
+
+struct xse2_function
+{
+    int entry_point;
+    int param_count;
+    int local_data_size;
+    int name_index;//string index of the function's name
+};
+
+//stack slots a function needs, worked out by the assembler.
+//a function's frame is its return address, locals and frame record, its parameters belong to the caller.
+//the whole program's record counts from the bottom of the stack: the globals, _Main's frame and everything _Main calls
+struct xse2_stack_depth
+{
+    int operand_depth;//most values the function's own code has pushed at once, XSE2_STACK_DEPTH_UNKNOWN if that can't be worked out
+    int stack_bound;//slots the frame, the operands and the calls made from it take at most, unknown if it may recurse
+};
+
+//table driven CRC-32(IEEE 802.3), eight bytes per step. pass the previous result as crc to continue a checksum
+struct xse_crc_table
+{
+    unsigned int entries[8][256];
+
+    xse_crc_table()
+    {
+        for(unsigned int i = 0; i < 256; ++i)
+        {
+            unsigned int crc = i;
+            for(int j = 0; j < 8; ++j)
+            {
+                crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+            }
+            entries[0][i] = crc;
+        }
+        for(unsigned int i = 0; i < 256; ++i)
+        {
+            for(int j = 1; j < 8; ++j)
+            {
+                entries[j][i] = (entries[j - 1][i] >> 8) ^ entries[0][entries[j - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+inline unsigned int xse_crc32(const void* data, size_t size, unsigned int crc = 0)
+{
+    static const xse_crc_table table;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    crc ^= 0xffffffffu;
+
+    for(; size >= 8; size -= 8, bytes += 8)
+    {
+        unsigned int low = crc ^ (bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned int)bytes[3] << 24));
+        crc = table.entries[7][low & 0xff] ^ table.entries[6][(low >> 8) & 0xff] ^
+              table.entries[5][(low >> 16) & 0xff] ^ table.entries[4][low >> 24] ^
+              table.entries[3][bytes[4]] ^ table.entries[2][bytes[5]] ^
+              table.entries[1][bytes[6]] ^ table.entries[0][bytes[7]];
+    }
+    for(; size > 0; --size, ++bytes)
+    {
+        crc = (crc >> 8) ^ table.entries[0][(crc ^ *bytes) & 0xff];
+    }
+
+    return crc ^ 0xffffffffu;
+}
+
+}//xscript
+
+#endif      //__XSCRIPT_XSE_FORMAT_HPP__
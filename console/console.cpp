@@ -2,32 +2,30 @@
 #include "xvm.hpp"
 #include "../common/utility.hpp"
 
-xscript::xvm::xvm vm;
-
-void host_api_print(int script_index)
+void host_api_print(xscript::xvm::xvm_interface* vm, int script_index, void* user_data)
 {
-    string s = vm.xvm_get_param_as_string(script_index, 0);
+    string s = vm->xvm_get_param_as_string(script_index, 0);
     printf("%s", s.c_str());
-    vm.xvm_return_from_host(script_index, 0);
+    vm->xvm_return_from_host(script_index, 0);
 }
 
-void host_api_print_newline(int script_index)
+void host_api_print_newline(xscript::xvm::xvm_interface* vm, int script_index, void* user_data)
 {
     printf("\n");
-    vm.xvm_return_from_host(script_index, 0);
+    vm->xvm_return_from_host(script_index, 0);
 }
 
-void host_api_print_tab(int script_index)
+void host_api_print_tab(xscript::xvm::xvm_interface* vm, int script_index, void* user_data)
 {
     printf("\t");
-    vm.xvm_return_from_host(script_index, 0);
+    vm->xvm_return_from_host(script_index, 0);
 }
 
 int main(int argc, char* argv[])
 {
     if(argc < 2)
     {
-        printf("Usage:\tx script.XSE\n");
+        printf("Usage:\tx script.XSE [-jit | -jit-check] [-fuel]\n");
         return 0;
     }
 
@@ -35,8 +33,27 @@ int main(int argc, char* argv[])
     printf("XScript Virtual Machine\n");
     printf("\n");
 
+    xscript::xvm::xvm vm;
     vm.xvm_init();
 
+    for(int i = 2; i < argc; ++i)
+    {
+        //optionally compile hot functions, or compile them and check every native run against the interpreter
+        if(strcmp(argv[i], "-jit") == 0)
+        {
+            vm.xvm_set_jit_mode(XS_JIT_ON);
+        }
+        else if(strcmp(argv[i], "-jit-check") == 0)
+        {
+            vm.xvm_set_jit_mode(XS_JIT_CROSS_CHECK);
+        }
+        //measure timeslices in instructions, so threads switch at the same points on every run
+        else if(strcmp(argv[i], "-fuel") == 0)
+        {
+            vm.xvm_set_timeslice_mode(XS_TIMESLICE_FUEL);
+        }
+    }
+
     int script_index;
     int error_code = vm.xvm_load_script(argv[1], script_index, XS_THREAD_PRIORITY_USER);
 
@@ -60,6 +77,9 @@ int main(int argc, char* argv[])
         case XS_LOAD_ERROR_OUT_OF_THREADS:
             printf("Out of threads");
             break;
+        case XS_LOAD_ERROR_INVALID_CODE:
+            printf("Invalid code");
+            break;
         }
         printf("\n");
 
@@ -83,6 +103,12 @@ int main(int argc, char* argv[])
         vm.xvm_run_script(500);
     }
 
+    //the VM only counts the runs the cross-check caught, reporting them is up to the host
+    if(vm.xvm_get_jit_mismatch_count() > 0)
+    {
+        printf("JIT mismatches: %d\n", vm.xvm_get_jit_mismatch_count());
+    }
+
     vm.xvm_shutdown();
     printf("XVM shutdown !!!\n\n\n");
     return 0;
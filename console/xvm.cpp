@@ -3,91 +3,436 @@
 namespace xscript {
 namespace xvm {
 
-xvm::xvm()
+thread_local xvm* xvm::worker_owner = NULL;
+thread_local int xvm::worker_index = 0;
+
+script_table::~script_table()
 {
+    clear();
 }
 
-xvm::~xvm()
+int script_table::get_free_slot()
 {
+    if(free_slots.empty())
+    {
+        script* slab = new script[SCRIPT_SLAB_SIZE];
+        for(int i = 0; i < SCRIPT_SLAB_SIZE; ++i)
+        {
+            slab[i].is_active = false;
+
+            slab[i].image = NULL;
+            slab[i].is_running = false;
+            slab[i].is_paused = false;
+            slab[i].schedule_queue = SCHEDULE_QUEUE_NONE;
+        }
+
+        //pushed in reverse, so the new slab is handed out from its first slot
+        int first_index = slabs.size() * SCRIPT_SLAB_SIZE;
+        slabs.push_back(slab);
+        for(int i = SCRIPT_SLAB_SIZE - 1; i >= 0; --i)
+        {
+            free_slots.push_back(first_index + i);
+        }
+    }
 
+    return free_slots.back();
 }
 
-void xvm::xvm_init()
+void script_table::take_free_slot()
 {
-    //initialize the script array
-    for(int i = 0; i < MAX_THREAD_COUNT; ++i)
-    {
-        scripts[i].is_active = false;
+    free_slots.pop_back();
+}
+
+void script_table::release_slot(int index)
+{
+    free_slots.push_back(index);
+}
 
-        scripts[i].is_running = false;
-        scripts[i].is_main_function_present = false;
-        scripts[i].is_paused = false;
+void script_table::clear()
+{
+    for(int i = 0; i < slabs.size(); ++i)
+    {
+        delete[] slabs[i];
     }
+    slabs.clear();
+    free_slots.clear();
+}
 
-    //initialize the host API
-    for(int i = 0; i < MAX_HOST_API_SIZE; ++i)
+xvm::xvm()
+{
+    //scripts run on the host's thread until xvm_set_worker_count asks for more
+    worker_count = 1;
+    pool_round = 0;
+    pool_busy_count = 0;
+    pool_timeslice = XS_INFINITE_TIMESLICE;
+    is_pool_stopping = false;
+    is_pool_round_running = false;
+}
+
+xvm::~xvm()
+{
+    stop_workers();
+}
+
+void xvm::xvm_init(int engine)
+{
+    //select the execution engine, falling back to the switch loop if computed goto is unavailable
+    exec_engine = XVM_HAS_COMPUTED_GOTO ? engine : XS_EXEC_ENGINE_SWITCH;
+
+    //fetch the threaded engine's handler table so scripts can be pre-decoded at load time
+    threaded_dispatch_table = NULL;
+    if(exec_engine == XS_EXEC_ENGINE_THREADED)
     {
-        host_apis[i].is_active = false;
+        execute_threaded(0, &threaded_dispatch_table);
     }
 
+    //the JIT tier is off until the host asks for it
+    jit_mode = XS_JIT_OFF;
+    jit_mismatch_count = 0;
+
+    //string table garbage collection
+    gc_cursor = 0;
+    gc_min_string_count = DEF_STRING_GC_MIN_COUNT;
+    gc_growth_percent = DEF_STRING_GC_GROWTH;
+    memset(&gc_stats, 0, sizeof(gc_stats));
+
+    //script slots are allocated as scripts are loaded
+    scripts.clear();
+
+    //initialize the host API
+    host_apis.clear();
+
     //set up the threads
-    current_thread = 0;
-    current_thread_mode = THREAD_MODE_MULTI;
+    for(int i = 0; i < MAX_WORKER_COUNT; ++i)
+    {
+        workers[i].current_thread = 0;
+        workers[i].current_thread_mode = THREAD_MODE_MULTI;
+        workers[i].current_thread_active_time = 0;
+        workers[i].thread_fuel = 0;
+        workers[i].run_depth = 0;
+    }
+    timeslice_mode = XS_TIMESLICE_CLOCK;
+    ready_head = -1;
+    for(int i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; ++i)
+    {
+        timer_slots[i] = -1;
+    }
+    timer_time = get_current_time();
+    sleeping_count = 0;
+    idle_mode = XS_IDLE_BLOCK;
+    load_mode = XS_LOAD_EAGER;
 }
 
 void xvm::xvm_shutdown ()
 {
+    stop_workers();
+
     //unload any scripts that may still be in memory
-    for(int i = 0; i < MAX_THREAD_COUNT; ++i)
+    for(int i = 0; i < scripts.size(); ++i)
     {
         xvm_unload_script(i);
     }
+    pools.clear();
 }
 
 int xvm::xvm_load_script(const char* script_name, int& script_index, int thread_timeslice)
 {
-    //find the next free script index
-    bool is_free_thread_found = false;
-    for(int i = 0; i < MAX_THREAD_COUNT; ++i)
+    //the slot is only taken off the free list once the script has loaded
+    script_index = scripts.get_free_slot();
+
+    //another instance of an executable that is already loaded only needs its own state
+    program_image* image = NULL;
+    int error_code = load_image(script_name, image);
+    if(error_code != XS_LOAD_OK)
+    {
+        return error_code;
+    }
+
+    script& s = scripts[script_index];
+    s.image = image;
+    s.code_stream.codes = image->codes.empty() ? NULL : &image->codes[0];
+
+    //the runtime stack is allocated by xvm_reset_script, the header only sets how far it may grow
+    s.stack.size = image->stack_size;
+    s.stack.high_water = 0;
+
+    //override the script-specified priority if necessary
+    int priority_type = image->priority_type;
+    if(thread_timeslice != XS_THREAD_PRIORITY_USER)
+    {
+        priority_type = thread_timeslice;
+    }
+
+    //if the priority type is not set to user-defined, fill in the appropriate timeslice duration
+    switch(priority_type)
+    {
+    case XS_THREAD_PRIORITY_LOW:
+        s.timeslice_duration = THREAD_PRIORITY_DUR_LOW;
+        break;
+    case XS_THREAD_PRIORITY_MED:
+        s.timeslice_duration = THREAD_PRIORITY_DUR_MED;
+        break;
+    case XS_THREAD_PRIORITY_HIGH:
+        s.timeslice_duration = THREAD_PRIORITY_DUR_HIGH;
+        break;
+    default:
+        s.timeslice_duration = image->timeslice_duration;
+        break;
+    }
+
+    //the instance's string table starts out as just the image's literals
+    s.pinned_string_count = image->string_table.size();
+    s.string_gc_threshold = get_string_gc_threshold(s.pinned_string_count);
+    s.pool_index = -1;
+    s.is_pooled_idle = false;
+
+    //resolve the names against the functions registered so far, later registrations rebind
+    bind_host_apis(script_index);
+
+    //the script is fully loaded and ready to go, so set the active flag
+    scripts.take_free_slot();
+    s.is_active = true;
+
+    //reset the scritp
+    xvm_reset_script(script_index);
+
+    return XS_LOAD_OK;
+}
+
+//bounds checked reads from a mapped executable. a read past the end returns zeroes and marks the
+//reader failed, so the loader only has to validate once per section instead of after every field
+static int read_xse_bytes(xse_reader& reader, void* dest, int size)
+{
+    if(reader.is_failed || size < 0 || reader.size - reader.offset < size)
+    {
+        reader.is_failed = true;
+        memset(dest, 0, size < 0 ? 0 : size);
+        return 0;
+    }
+    memcpy(dest, reader.data + reader.offset, size);
+    reader.offset += size;
+    return size;
+}
+
+static int read_xse_byte(xse_reader& reader)
+{
+    unsigned char value;
+    read_xse_bytes(reader, &value, 1);
+    return value;
+}
+
+static int read_xse_word(xse_reader& reader)
+{
+    unsigned short value;
+    read_xse_bytes(reader, &value, 2);
+    return value;
+}
+
+static int read_xse_int(xse_reader& reader)
+{
+    int value;
+    read_xse_bytes(reader, &value, 4);
+    return value;
+}
+
+//points into the mapping and skips size bytes, NULL if they are not all there
+static const char* read_xse_span(xse_reader& reader, int size)
+{
+    if(reader.is_failed || size < 0 || reader.size - reader.offset < size)
+    {
+        reader.is_failed = true;
+        return NULL;
+    }
+    const char* span = reinterpret_cast<const char*>(reader.data + reader.offset);
+    reader.offset += size;
+    return span;
+}
+
+//rejects a table count that could not fit in the rest of the file, before anything is allocated for it
+static bool check_xse_count(xse_reader& reader, int count, int min_record_size)
+{
+    if(reader.is_failed || count < 0 || count > (reader.size - reader.offset) / min_record_size)
+    {
+        reader.is_failed = true;
+        return false;
+    }
+    return true;
+}
+
+//copies a v2 instruction record into the interpreter's form
+static void decode_instruction(const xse2_instruction& instruction, xvm_code& code)
+{
+    code.opcode = instruction.opcode;
+    code.opcount = instruction.opcount;
+
+    for(int j = 0; j < code.opcount; ++j)
     {
-        if(!scripts[i].is_active)
+        const xse2_operand& op = instruction.oplist[j];
+        xvm_operand& oplist = code.oplist[j];
+        oplist.type = op.type;
+
+        //every operand kind but float literals shares the int member of the union
+        if(op.type == OP_TYPE_FLOAT)
         {
-            script_index = i;
-            is_free_thread_found = true;
-            break;
+            oplist.float_literal = op.float_literal;
+        }
+        else
+        {
+            oplist.int_literal = op.int_literal;
+        }
+        if(op.type == OP_TYPE_REL_STACK_INDEX)
+        {
+            oplist.offset_index = op.offset_index;
+        }
+    }
+}
+
+int xvm::load_image(const char* script_name, program_image*& image)
+{
+    for(int i = 0; i < images.size(); ++i)
+    {
+        if(images[i]->file_name == script_name)
+        {
+            image = images[i];
+            ++image->ref_count;
+            return XS_LOAD_OK;
         }
     }
 
-    //if a thread wasn't found, return an out of threads error
-    if(!is_free_thread_found)
+    //open the input file, the whole executable is decoded from memory with a single read or mapping
+    int script_file = open(script_name, O_RDONLY);
+    if(script_file < 0)
     {
-        return XS_LOAD_ERROR_OUT_OF_THREADS;
+        return XS_LOAD_ERROR_FILE_IO;
     }
 
-    //open the input file
-    FILE* script_file;
-    if(!(script_file = fopen(script_name, "rb")))
+    struct stat file_stat;
+    if(fstat(script_file, &file_stat) != 0)
     {
+        close(script_file);
         return XS_LOAD_ERROR_FILE_IO;
     }
 
-    //----------read the header------------//
-    //read the file's ID(4 bytes) and append a null terminator
-    char script_file_ID[5];
-    fread(script_file_ID, 4, 1, script_file);
-    script_file_ID[4] = '\0';
+    //too small to hold a header(or too big to index with an int), it can't be an executable
+    if(file_stat.st_size < 6 || file_stat.st_size > INT_MAX)
+    {
+        close(script_file);
+        return XS_LOAD_ERROR_INVALID_XSE;
+    }
+
+    //small executables are cheaper to read in one go than to map and unmap
+    xse_reader reader;
+    reader.size = static_cast<int>(file_stat.st_size);
+    reader.offset = 0;
+    reader.is_failed = false;
+
+    void* mapping = NULL;
+    std::vector<unsigned char> buffer;
+    if(reader.size <= XSE_MAP_THRESHOLD)
+    {
+        buffer.resize(reader.size);
+        bool is_read = read(script_file, &buffer[0], reader.size) == reader.size;
+        close(script_file);
+        if(!is_read)
+        {
+            return XS_LOAD_ERROR_FILE_IO;
+        }
+        reader.data = &buffer[0];
+    }
+    else
+    {
+        mapping = mmap(NULL, reader.size, PROT_READ, MAP_PRIVATE, script_file, 0);
+        close(script_file);
+        if(mapping == MAP_FAILED)
+        {
+            return XS_LOAD_ERROR_FILE_IO;
+        }
+        madvise(mapping, reader.size, MADV_SEQUENTIAL);
+        reader.data = static_cast<const unsigned char*>(mapping);
+    }
+
+    image = new program_image();
+    image->file_name = script_name;
+    image->ref_count = 1;
+    image->encoded_codes = NULL;
+    image->file_mapping = NULL;
+    image->file_mapping_size = 0;
+    image->stack_bound = XSE2_STACK_DEPTH_UNKNOWN;
+    image->is_stack_proven = false;
+
+    //the file ID tells the layouts apart, v0.8 executables are still accepted
+    int result;
+    if(memcmp(reader.data, XSE2_ID_STRING, 4) == 0)
+    {
+        result = decode_image_v2(reader, *image, load_mode == XS_LOAD_LAZY);
+    }
+    else
+    {
+        result = decode_image_v08(reader, *image);
+    }
+
+    //a lazily loaded image decodes from the file's bytes later on, so it takes them over
+    if(result == XS_LOAD_OK && image->encoded_codes)
+    {
+        image->file_data.swap(buffer);
+        image->file_mapping = mapping;
+        image->file_mapping_size = reader.size;
+        mapping = NULL;
+    }
+    if(mapping)
+    {
+        munmap(mapping, reader.size);
+    }
+
+    if(result != XS_LOAD_OK)
+    {
+        delete image;
+        image = NULL;
+        return result;
+    }
 
-    //check file's ID
-    if(strcmp(script_file_ID, XSE_ID_STRING) != 0)
+    index_image_strings(*image);
+    index_functions(*image);
+    if(!image->encoded_codes)
+    {
+        prepare_code(*image, 0, image->codes.size());
+    }
+    else
+    {
+        //code in front of the first function doesn't belong to any, it is decoded right away
+        int first_entry_point = image->codes.size();
+        for(int i = 0; i < image->function_table.size(); ++i)
+        {
+            if(image->function_table[i].entry_point >= 0 && image->function_table[i].entry_point < first_entry_point)
+            {
+                first_entry_point = image->function_table[i].entry_point;
+            }
+        }
+        for(int i = 0; i < first_entry_point; ++i)
+        {
+            decode_instruction(image->encoded_codes[i], image->codes[i]);
+            image->codes[i].function_index = -1;
+        }
+        prepare_code(*image, 0, first_entry_point);
+    }
+
+    images.push_back(image);
+    return XS_LOAD_OK;
+}
+
+int xvm::decode_image_v08(xse_reader& reader, program_image& image)
+{
+    //----------read the header------------//
+    //check the file's ID(4 bytes)
+    const char* script_file_ID = read_xse_span(reader, 4);
+    if(!script_file_ID || memcmp(script_file_ID, XSE_ID_STRING, 4) != 0)
     {
         return XS_LOAD_ERROR_INVALID_XSE;
     }
 
     //read the script version(2 bytes)
-    int major_version = 0;
-    int minor_version = 0;
-    fread(&major_version, 1, 1, script_file);
-    fread(&minor_version, 1, 1, script_file);
+    int major_version = read_xse_byte(reader);
+    int minor_version = read_xse_byte(reader);
 
     //check version
     if(major_version != MAJOR_VERSION || minor_version != MINOR_VERSION)
@@ -96,832 +441,3613 @@ int xvm::xvm_load_script(const char* script_name, int& script_index, int thread_
     }
 
     //read the stack size(4 bytes)
-    int stack_size = 0;
-    fread(&stack_size, 4, 1, script_file);
+    int stack_size = read_xse_int(reader);
 
     //check for a default stack size request
-    stack_size = stack_size == 0 ? DEF_STACK_SIZE : stack_size;
-    scripts[script_index].stack.size = stack_size;
-
-    //allocate the runtime stack
-    scripts[script_index].stack.elements.resize(stack_size);
+    image.stack_size = stack_size == 0 ? DEF_STACK_SIZE : stack_size;
 
     //read the global data size(4 bytes)
-    fread(&scripts[script_index].global_data_size, 4, 1, script_file);
+    image.global_data_size = read_xse_int(reader);
 
     //check for presence of _Main() (1byte)
-    fread(&scripts[script_index].is_main_function_present, 1, 1, script_file);
+    image.is_main_function_present = read_xse_byte(reader);
 
     //read _Main()'s function index(4 bytes)
-    fread(&scripts[script_index].main_function_index, 4, 1, script_file);
+    image.main_function_index = read_xse_int(reader);
 
     //read the priority type(1 byte)
-    int priority_type = 0;
-    fread(&priority_type, 1, 1, script_file);
+    image.priority_type = read_xse_byte(reader);
 
     //read the user-defined priority(4 bytes)
-    fread(&scripts[script_index].timeslice_duration, 4, 1, script_file);
-
-    //override the script-specified priority if necessary
-    if(thread_timeslice != XS_THREAD_PRIORITY_USER)
-    {
-        priority_type = thread_timeslice;
-    }
+    image.timeslice_duration = read_xse_int(reader);
 
-    //if the priority type is not set to user-defined, fill in the appropriate timeslice duration
-    switch(priority_type)
+    //--------------read the instruction stream--------------------//
+    //read the instruction count (4 bytes), every instruction takes at least 3 bytes
+    int code_stream_size = read_xse_int(reader);
+    if(!check_xse_count(reader, code_stream_size, 3))
     {
-    case XS_THREAD_PRIORITY_LOW:
-        scripts[script_index].timeslice_duration = THREAD_PRIORITY_DUR_LOW;
-        break;
-    case XS_THREAD_PRIORITY_MED:
-        scripts[script_index].timeslice_duration = THREAD_PRIORITY_DUR_MED;
-        break;
-    case XS_THREAD_PRIORITY_HIGH:
-        scripts[script_index].timeslice_duration = THREAD_PRIORITY_DUR_HIGH;
-        break;
+        return XS_LOAD_ERROR_INVALID_XSE;
     }
 
-    //--------------read the instruction stream--------------------//
-    //read the instruction count (4 bytes)
-    int code_stream_size = 0;
-    fread(&code_stream_size, 4, 1, script_file);
-
-    //allocate the stream
-    scripts[script_index].code_stream.codes.resize(code_stream_size);
+    //allocate the stream, every instruction carries its operands inline so this is the only allocation
+    xvm_code_vector& codes = image.codes;
+    codes.resize(code_stream_size);
 
     //read the instruction data
-    for(int i = 0; i < scripts[script_index].code_stream.codes.size(); ++i)
+    for(int i = 0; i < code_stream_size; ++i)
     {
+        xvm_code& code = codes[i];
+
         //read the opcode(2 bytes)
-        scripts[script_index].code_stream.codes[i].opcode = 0;
-        fread(&scripts[script_index].code_stream.codes[i].opcode, 2, 1, script_file);
-        int oc = scripts[script_index].code_stream.codes[i].opcode;
+        code.opcode = read_xse_word(reader);
 
         //read the operand count(1 byte)
-        scripts[script_index].code_stream.codes[i].opcount = 0;
-        fread(&scripts[script_index].code_stream.codes[i].opcount, 1, 1, script_file);
+        code.opcount = read_xse_byte(reader);
 
-        int opcount = scripts[script_index].code_stream.codes[i].opcount;
-
-        //assign the operand list pointer to the instruction stream
-        scripts[script_index].code_stream.codes[i].oplist.resize(opcount);
-        value_vector& oplist =scripts[script_index].code_stream.codes[i].oplist;
+        //superinstructions only come from fusing at load time, never from the file
+        if(reader.is_failed || code.opcode > INSTR_EXIT || code.opcount > MAX_OPERAND_COUNT)
+        {
+            return XS_LOAD_ERROR_INVALID_XSE;
+        }
 
         //read in the operand list(N bytes)
-        for(int j = 0; j < opcount; ++j)
+        xvm_operand* oplist = code.oplist;
+        for(int j = 0; j < code.opcount; ++j)
         {
             //read in the operand type(1 byte)
-            oplist[j].type = 0;
-            fread(&oplist[j].type, 1, 1, script_file);
+            oplist[j].type = read_xse_byte(reader);
 
             //depending on the type, read in the operand data
             switch(oplist[j].type)
             {
             case OP_TYPE_INT:
-                fread(&oplist[j].int_literal, sizeof(int), 1, script_file);
+                oplist[j].int_literal = read_xse_int(reader);
                 break;
             case OP_TYPE_FLOAT:
-                fread(&oplist[j].float_literal, sizeof(float), 1, script_file);
+                read_xse_bytes(reader, &oplist[j].float_literal, sizeof(float));
                 break;
             case OP_TYPE_STRING_INDEX:
-                fread(&oplist[j].string_index, sizeof(int), 1, script_file);
-                //oplist[j].type = OP_TYPE_STRING_INDEX;
+                oplist[j].string_index = read_xse_int(reader);
                 break;
             case OP_TYPE_INSTR_INDEX:
-                fread(&oplist[j].instruction_index, sizeof(int), 1, script_file);
+                oplist[j].instruction_index = read_xse_int(reader);
                 break;
             case OP_TYPE_ABS_STACK_INDEX:
-                fread(&oplist[j].stack_index, sizeof(int), 1, script_file);
+                oplist[j].stack_index = read_xse_int(reader);
                 break;
             case OP_TYPE_REL_STACK_INDEX:
-                fread(&oplist[j].stack_index, sizeof(int), 1, script_file);
-                fread(&oplist[j].offset_index, sizeof(int), 1, script_file);
+                oplist[j].stack_index = read_xse_int(reader);
+                oplist[j].offset_index = read_xse_int(reader);
                 break;
             case OP_TYPE_FUNC_INDEX:
-                fread(&oplist[j].function_index, sizeof(int), 1, script_file);
+                oplist[j].function_index = read_xse_int(reader);
                 break;
             case OP_TYPE_HOST_API_CALL_INDEX:
-                fread(&oplist[j].host_api_index, sizeof(int), 1, script_file);
+                oplist[j].host_api_index = read_xse_int(reader);
                 break;
             case OP_TYPE_REG:
-                fread(&oplist[j].reg, sizeof(int), 1, script_file);
+                oplist[j].reg = read_xse_int(reader);
                 break;
             }
         }
     }
 
     //-------------read the string table----------------//
-    //read the table size(4 bytes)
-    int string_table_size = 0;
-    fread(&string_table_size, 4, 1, script_file);
-
-    //if the string table exists, read it
-    if(string_table_size > 0)
+    //read the table size(4 bytes), every string takes at least its 4 byte length
+    int string_table_size = read_xse_int(reader);
+    if(!check_xse_count(reader, string_table_size, 4))
     {
-        scripts[script_index].string_table.resize(string_table_size);
+        return XS_LOAD_ERROR_INVALID_XSE;
+    }
+    image.string_table.resize(string_table_size);
 
-        //read in each string
-        for(int i = 0; i < string_table_size; ++i)
+    //read in each string
+    for(int i = 0; i < string_table_size; ++i)
+    {
+        //read in the string size(4 bytes) and copy the data(N bytes) straight out of the mapping
+        int string_size = read_xse_int(reader);
+        const char* string_data = read_xse_span(reader, string_size);
+        if(!string_data)
         {
-            //read in the string size(4 bytes)
-            int string_size = 0;
-            fread(&string_size, 4, 1, script_file);
-
-            //read in the string data(N bytes) and append the null terminator            
-            char ss[string_size + 1];
-            fread(ss, string_size, 1, script_file);
-            ss[string_size] = '\0';
-
-            //assign the string pointer to the string table
-            scripts[script_index].string_table[i] = ss;
+            return XS_LOAD_ERROR_INVALID_XSE;
         }
+        image.string_table[i].assign(string_data, string_size);
     }
 
     //--------------read the function table--------------//
-    int function_table_size = 0;
-    fread(&function_table_size, 4, 1, script_file);
-    scripts[script_index].function_table.resize(function_table_size);
+    //every function takes at least 10 bytes
+    int function_table_size = read_xse_int(reader);
+    if(!check_xse_count(reader, function_table_size, 10))
+    {
+        return XS_LOAD_ERROR_INVALID_XSE;
+    }
+    image.function_table.resize(function_table_size);
 
     //read each function
     for(int i = 0; i < function_table_size; ++ i)
     {
         //read the entry point(4 bytes)
-        int entry_point = 0;
-        fread(&entry_point, 4, 1, script_file);
+        int entry_point = read_xse_int(reader);
 
         //read the parameter count(1 byte)
-        int param_count = 0;
-        fread(&param_count, 1, 1, script_file);
+        int param_count = read_xse_byte(reader);
 
         //read the local data size(4 bytes)
-        int local_data_size = 0;
-        fread(&local_data_size, 4, 1, script_file);
+        int local_data_size = read_xse_int(reader);
 
         //calculate the stack size
         int stack_frame_size = param_count + 1 + local_data_size;
 
-        //read the function name length(1 byte)
-        int function_name_len = 0;
-        fread(&function_name_len, 1, 1, script_file);
+        //read the function name length(1 byte) and the name (N bytes)
+        int function_name_len = read_xse_byte(reader);
+        const char* function_name = read_xse_span(reader, function_name_len);
+        if(!function_name)
+        {
+            return XS_LOAD_ERROR_INVALID_XSE;
+        }
 
-        //read the function name (N bytes) and append a null-terminator
-        char function_name[function_name_len + 1];
-        fread(function_name, function_name_len, 1, script_file);
-        function_name[function_name_len] = '\0';
-printf("FUNCTION [%d:%s]\n", i, function_name);
         //write everything to the function table
-        scripts[script_index].function_table[i].name = function_name;
-        scripts[script_index].function_table[i].entry_point = entry_point;
-        scripts[script_index].function_table[i].param_count = param_count;
-        scripts[script_index].function_table[i].local_data_size = local_data_size;
-        scripts[script_index].function_table[i].stack_frame_size = stack_frame_size;
+        image.function_table[i].name.assign(function_name, function_name_len);
+printf("FUNCTION [%d:%s]\n", i, image.function_table[i].name.c_str());
+        image.function_table[i].entry_point = entry_point;
+        image.function_table[i].param_count = param_count;
+        image.function_table[i].local_data_size = local_data_size;
+        image.function_table[i].stack_frame_size = stack_frame_size;
+        image.function_table[i].operand_depth = XSE2_STACK_DEPTH_UNKNOWN;
+        image.function_table[i].call_count = 0;
+        image.function_table[i].back_edge_count = 0;
+        image.function_table[i].is_jit_failed = false;
+        image.function_table[i].native = NULL;
     }
 
     //-----------read the host api table-------------//
-    //read the host api count
-    int host_api_table_size = 0;
-    fread(&host_api_table_size, 4, 1, script_file);
+    //read the host api count, every name takes at least its 1 byte length
+    int host_api_table_size = read_xse_int(reader);
+    if(!check_xse_count(reader, host_api_table_size, 1))
+    {
+        return XS_LOAD_ERROR_INVALID_XSE;
+    }
 
     //allocate the table
-    scripts[script_index].host_api_table.resize(host_api_table_size);
+    image.host_api_table.resize(host_api_table_size);
 
     //read each host API
     for(int i = 0; i < host_api_table_size; ++ i)
     {
-        //read the host API call string size(1 byte)
-        int host_api_name_len = 0;
-        fread(&host_api_name_len, 1, 1, script_file);
-
-        //allocate space for the string
-        char host_api_name[host_api_name_len + 1];
-
-        //read the host api
-        fread(host_api_name, host_api_name_len, 1, script_file);
-        host_api_name[host_api_name_len] = '\0';
+        //read the host API call string size(1 byte) and the name
+        int host_api_name_len = read_xse_byte(reader);
+        const char* host_api_name = read_xse_span(reader, host_api_name_len);
+        if(!host_api_name)
+        {
+            return XS_LOAD_ERROR_INVALID_XSE;
+        }
 
         //set host API
-        scripts[script_index].host_api_table[i] = host_api_name;
+        image.host_api_table[i].assign(host_api_name, host_api_name_len);
     }
 
-    //------------close the input file----------------//
-    fclose(script_file);
-
-    //the script is fully loaded and ready to go, so set the active flag
-    scripts[script_index].is_active = true;
-    bool ita = is_thread_active(script_index);
-
-    //reset the scritp
-    xvm_reset_script(script_index);
+    return verify_image(image, NULL);
+}
 
-    return XS_LOAD_OK;
+//the program bound stacks the globals under _Main's bound, so a recorded depth never gets past twice the verifier's limit
+static bool is_recorded_depth_valid(int depth)
+{
+    return depth == XSE2_STACK_DEPTH_UNKNOWN || (depth >= 0 && depth <= 2 * MAX_VERIFIED_DATA_SIZE);
 }
 
-void xvm::xvm_unload_script(int script_index)
+int xvm::decode_image_v2(xse_reader& reader, program_image& image, bool is_lazy)
 {
-    if(!scripts[script_index].is_active)
+    //----------read the header------------//
+    xse2_header header;
+    read_xse_bytes(reader, &header, sizeof(header));
+    if(reader.is_failed)
     {
-        return;
+        return XS_LOAD_ERROR_INVALID_XSE;
+    }
+
+    //newer minor versions only add section types, which are skipped
+    if(header.major_version != XSE2_MAJOR_VERSION)
+    {
+        return XS_LOAD_ERROR_UNSUPPORTED_VERS;
+    }
+
+    //the header checksum covers the header with its own field zeroed and the section table
+    const char* section_table = read_xse_span(reader, header.section_count * sizeof(xse2_section));
+    unsigned int header_crc = header.crc;
+    header.crc = 0;
+    if(!section_table ||
+        xse_crc32(section_table, header.section_count * sizeof(xse2_section), xse_crc32(&header, sizeof(header))) != header_crc)
+    {
+        return XS_LOAD_ERROR_INVALID_XSE;
     }
 
-    /*for(int i = 0; i < scripts[script_index].code_stream.codes.size(); ++i)
+    //-----------locate and check the sections-------------//
+    const xse2_section* sections[XSE2_SECTION_COUNT] = {};
+    for(int i = 0; i < header.section_count; ++i)
     {
-        int opcount = scripts[script_index].code_stream.codes[i].opcount;
-        value_vector& oplist = scripts[script_index].code_stream.codes[i].oplist;
+        const xse2_section* section = reinterpret_cast<const xse2_section*>(section_table) + i;
+        if(section->type >= XSE2_SECTION_COUNT)
+        {
+            continue;
+        }
+
+        if(sections[section->type] ||
+            section->offset % XSE2_SECTION_ALIGNMENT != 0 ||
+            section->offset > reader.size || section->size > reader.size - section->offset ||
+            xse_crc32(reader.data + section->offset, section->size) != section->crc)
+        {
+            return XS_LOAD_ERROR_INVALID_XSE;
+        }
+        sections[section->type] = section;
+    }
 
-        for(int j = 0; j < opcount; ++j)
+    //the 2.0 sections are required, every section must hold exactly its records
+    static const int record_sizes[XSE2_SECTION_COUNT] =
+    {
+        sizeof(xse2_instruction), sizeof(unsigned int), 1, sizeof(xse2_function), sizeof(int), sizeof(xse2_stack_depth)
+    };
+    for(int i = 0; i < XSE2_SECTION_COUNT; ++i)
+    {
+        if(!sections[i])
         {
-            if(oplist[j].string_literal)
+            if(i < XSE2_REQUIRED_SECTION_COUNT)
             {
-                free(oplist[j].string_literal);
+                return XS_LOAD_ERROR_INVALID_XSE;
             }
+            continue;
+        }
+        if(i != XSE2_SECTION_STRING_DATA && sections[i]->size != (unsigned long long)sections[i]->count * record_sizes[i])
+        {
+            return XS_LOAD_ERROR_INVALID_XSE;
         }
     }
 
-    for(int i = 0; i < scripts[script_index].stack.elements.size(); ++i)
+    image.stack_size = header.stack_size == 0 ? DEF_STACK_SIZE : header.stack_size;
+    image.global_data_size = header.global_data_size;
+    image.is_main_function_present = header.is_main_function_present;
+    image.main_function_index = header.main_function_index;
+    image.priority_type = header.priority_type;
+    image.timeslice_duration = header.timeslice_duration;
+
+    //-------------check the string table----------------//
+    //offsets must climb through the string data and every string must end with its null terminator
+    const unsigned int* string_offsets = reinterpret_cast<const unsigned int*>(reader.data + sections[XSE2_SECTION_STRING_OFFSETS]->offset);
+    const char* string_data = reinterpret_cast<const char*>(reader.data + sections[XSE2_SECTION_STRING_DATA]->offset);
+    int string_count = sections[XSE2_SECTION_STRING_OFFSETS]->count - 1;
+    if(string_count < 0 || string_offsets[0] != 0 || string_offsets[string_count] != sections[XSE2_SECTION_STRING_DATA]->size ||
+        header.string_literal_count < 0 || header.string_literal_count > string_count)
+    {
+        return XS_LOAD_ERROR_INVALID_XSE;
+    }
+    for(int i = 0; i < string_count; ++i)
     {
-        if(scripts[script_index].stack.elements[i].type == OP_TYPE_STRING_INDEX)
+        if(string_offsets[i + 1] <= string_offsets[i] || string_data[string_offsets[i + 1] - 1] != '\0')
         {
-            free(scripts[script_index].stack.elements[i].string_literal);
+            return XS_LOAD_ERROR_INVALID_XSE;
         }
-    }*/
+    }
 
-    scripts[script_index].code_stream.codes.clear();
-    scripts[script_index].stack.elements.clear();
-    scripts[script_index].function_table.clear();
-    scripts[script_index].host_api_table.clear();
-    scripts[script_index].string_table.clear();
-}
+    //the literals make up the script's string table
+    image.string_table.resize(header.string_literal_count);
+    for(int i = 0; i < header.string_literal_count; ++i)
+    {
+        image.string_table[i].assign(string_data + string_offsets[i], string_offsets[i + 1] - string_offsets[i] - 1);
+    }
 
-void xvm::xvm_reset_script(int script_index)
-{
-    int main_function_index = scripts[script_index].main_function_index;
+    //--------------decode the instruction stream--------------------//
+    const xse2_instruction* instructions = reinterpret_cast<const xse2_instruction*>(reader.data + sections[XSE2_SECTION_CODE]->offset);
+    int code_stream_size = sections[XSE2_SECTION_CODE]->count;
+    xvm_code_vector& codes = image.codes;
+    codes.resize(code_stream_size);
 
-    if(scripts[script_index].function_table.size() > 0)
+    for(int i = 0; i < code_stream_size; ++i)
     {
-        if(scripts[script_index].is_main_function_present)
+        //superinstructions only come from fusing at load time, never from the file
+        const xse2_instruction& instruction = instructions[i];
+        if(instruction.opcode > INSTR_EXIT || instruction.opcount > MAX_OPERAND_COUNT || instruction.opcount > XSE2_MAX_OPERAND_COUNT)
+        {
+            return XS_LOAD_ERROR_INVALID_XSE;
+        }
+
+        //functions of a lazily loaded image are decoded on their first call
+        if(!is_lazy)
         {
-            scripts[script_index].code_stream.current_code = scripts[script_index].function_table[main_function_index].entry_point;
+            decode_instruction(instruction, codes[i]);
         }
     }
+    if(is_lazy)
+    {
+        image.encoded_codes = instructions;
+    }
 
-    scripts[script_index].stack.top = 0;
-    scripts[script_index].stack.frame = 0;
+    //--------------read the function table--------------//
+    const xse2_function* functions = reinterpret_cast<const xse2_function*>(reader.data + sections[XSE2_SECTION_FUNCTIONS]->offset);
+    int function_table_size = sections[XSE2_SECTION_FUNCTIONS]->count;
+    image.function_table.resize(function_table_size);
 
-    for(int i = 0; i < scripts[script_index].stack.elements.size(); ++i)
+    for(int i = 0; i < function_table_size; ++i)
     {
-        scripts[script_index].stack.elements[i].type = OP_TYPE_NULL;
+        const xse2_function& record = functions[i];
+        if(record.name_index < header.string_literal_count || record.name_index >= string_count)
+        {
+            return XS_LOAD_ERROR_INVALID_XSE;
+        }
+
+        function& f = image.function_table[i];
+        f.name = string_data + string_offsets[record.name_index];
+        f.entry_point = record.entry_point;
+        f.param_count = record.param_count;
+        f.local_data_size = record.local_data_size;
+        f.stack_frame_size = record.param_count + 1 + record.local_data_size;
+        f.operand_depth = XSE2_STACK_DEPTH_UNKNOWN;
+        f.call_count = 0;
+        f.back_edge_count = 0;
+        f.is_jit_failed = false;
+        f.native = NULL;
     }
 
-    scripts[script_index].is_paused = false;
+    //-----------read the host api table-------------//
+    const int* host_apis = reinterpret_cast<const int*>(reader.data + sections[XSE2_SECTION_HOST_APIS]->offset);
+    int host_api_table_size = sections[XSE2_SECTION_HOST_APIS]->count;
+    image.host_api_table.resize(host_api_table_size);
 
-    //allocate space for the globals
-    push_frame(script_index, scripts[script_index].global_data_size);
+    for(int i = 0; i < host_api_table_size; ++i)
+    {
+        if(host_apis[i] < header.string_literal_count || host_apis[i] >= string_count)
+        {
+            return XS_LOAD_ERROR_INVALID_XSE;
+        }
+        image.host_api_table[i] = string_data + string_offsets[host_apis[i]];
+    }
 
-    //if _Main() is present, push its stack frame
-    push_frame(script_index, scripts[script_index].function_table[main_function_index].local_data_size + 1);
+    //-----------read the stack depths-------------//
+    //2.0 executables don't have them, the verifier works them out either way and checks the recorded ones against its own
+    const xse2_stack_depth* stack_depths = NULL;
+    if(sections[XSE2_SECTION_STACK_DEPTHS])
+    {
+        if(sections[XSE2_SECTION_STACK_DEPTHS]->count != function_table_size + 1)
+        {
+            return XS_LOAD_ERROR_INVALID_XSE;
+        }
+        stack_depths = reinterpret_cast<const xse2_stack_depth*>(reader.data + sections[XSE2_SECTION_STACK_DEPTHS]->offset);
+
+        //anything past what the verifier would accept can't have come from the assembler
+        for(int i = 0; i <= function_table_size; ++i)
+        {
+            if(!is_recorded_depth_valid(stack_depths[i].operand_depth) || !is_recorded_depth_valid(stack_depths[i].stack_bound))
+            {
+                return XS_LOAD_ERROR_INVALID_XSE;
+            }
+        }
+    }
+
+    int result = verify_image(image, stack_depths);
+    if(result != XS_LOAD_OK)
+    {
+        return result;
+    }
+
+    //without a stack size of its own, a script whose run is bounded gets all the stack it needs
+    if(header.stack_size == 0 && image.stack_bound > image.stack_size)
+    {
+        image.stack_size = image.stack_bound;
+    }
+
+    return XS_LOAD_OK;
 }
 
-void xvm::xvm_run_script(int timeslice_duration)
+//operand counts and the operand kinds(OP_FLAG_TYPE_*) each operand accepts, in INSTR order. they match the assembler's instruction set
+#define     SOURCE_OPERAND_FLAGS    (OP_FLAG_TYPE_INT | OP_FLAG_TYPE_FLOAT | OP_FLAG_TYPE_STRING | OP_FLAG_TYPE_MEM_REF | OP_FLAG_TYPE_REG)
+#define     DEST_OPERAND_FLAGS      (OP_FLAG_TYPE_MEM_REF | OP_FLAG_TYPE_REG)
+
+struct instruction_signature
 {
-    //begin a loop that runs until a keypress. the instruction pointer has already been
-    //initialized with a prior call to reset_script(), so execution can begin
+    int operand_count;
+    int operand_flags[MAX_OPERAND_COUNT];
+};
 
-    int is_exit_execute_loop = false;
-    int main_timeslice_start_time = get_current_time();
-    int current_time;
+static const instruction_signature INSTRUCTION_SIGNATURES[INSTR_EXIT + 1] =
+{
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//Mov
+
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//Add
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//Sub
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//Mul
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//Div
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//Mod
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//Exp
+    { 1, { DEST_OPERAND_FLAGS } },//Neg
+    { 1, { DEST_OPERAND_FLAGS } },//Inc
+    { 1, { DEST_OPERAND_FLAGS } },//Dec
+
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//And
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//Or
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//XOr
+    { 1, { DEST_OPERAND_FLAGS } },//Not
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//ShL
+    { 2, { DEST_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS } },//ShR
+
+    { 2, { DEST_OPERAND_FLAGS, DEST_OPERAND_FLAGS | OP_FLAG_TYPE_STRING } },//Concat
+    { 3, { DEST_OPERAND_FLAGS, DEST_OPERAND_FLAGS | OP_FLAG_TYPE_STRING, DEST_OPERAND_FLAGS | OP_FLAG_TYPE_INT } },//GetChar
+    { 3, { DEST_OPERAND_FLAGS, DEST_OPERAND_FLAGS | OP_FLAG_TYPE_INT, DEST_OPERAND_FLAGS | OP_FLAG_TYPE_STRING } },//SetChar
+
+    { 1, { OP_FLAG_TYPE_LINE_LABEL } },//Jmp
+    { 3, { SOURCE_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS, OP_FLAG_TYPE_LINE_LABEL } },//JE
+    { 3, { SOURCE_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS, OP_FLAG_TYPE_LINE_LABEL } },//JNE
+    { 3, { SOURCE_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS, OP_FLAG_TYPE_LINE_LABEL } },//JG
+    { 3, { SOURCE_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS, OP_FLAG_TYPE_LINE_LABEL } },//JL
+    { 3, { SOURCE_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS, OP_FLAG_TYPE_LINE_LABEL } },//JGE
+    { 3, { SOURCE_OPERAND_FLAGS, SOURCE_OPERAND_FLAGS, OP_FLAG_TYPE_LINE_LABEL } },//JLE
+
+    { 1, { SOURCE_OPERAND_FLAGS } },//Push
+    { 1, { DEST_OPERAND_FLAGS } },//Pop
+
+    { 1, { OP_FLAG_TYPE_FUNC_NAME } },//Call
+    { 0, { 0 } },//Ret
+    { 1, { OP_FLAG_TYPE_HOST_API_CALL } },//CallHost, an int parameter count may follow
+
+    { 1, { SOURCE_OPERAND_FLAGS } },//Pause
+    { 1, { SOURCE_OPERAND_FLAGS } },//Exit
+};
+
+static int get_operand_flag(int operand_type)
+{
+    switch(operand_type)
+    {
+    case OP_TYPE_INT:                   return OP_FLAG_TYPE_INT;
+    case OP_TYPE_FLOAT:                 return OP_FLAG_TYPE_FLOAT;
+    case OP_TYPE_STRING_INDEX:          return OP_FLAG_TYPE_STRING;
+    case OP_TYPE_ABS_STACK_INDEX:
+    case OP_TYPE_REL_STACK_INDEX:       return OP_FLAG_TYPE_MEM_REF;
+    case OP_TYPE_INSTR_INDEX:           return OP_FLAG_TYPE_LINE_LABEL;
+    case OP_TYPE_FUNC_INDEX:            return OP_FLAG_TYPE_FUNC_NAME;
+    case OP_TYPE_HOST_API_CALL_INDEX:   return OP_FLAG_TYPE_HOST_API_CALL;
+    case OP_TYPE_REG:                   return OP_FLAG_TYPE_REG;
+    default:                            return 0;
+    }
+}
 
-    while(true)
+//globals are indexed from the bottom of the stack, everything else from the function's frame:
+//the locals and the frame record, then the return address and the parameters. _Main's frame has no return address
+static bool is_stack_index_valid(const program_image& image, int function_index, int stack_index)
+{
+    if(stack_index >= 0)
+    {
+        return stack_index < image.global_data_size;
+    }
+
+    const function& f = image.function_table[function_index];
+    bool is_main_function = image.is_main_function_present && function_index == image.main_function_index;
+    return stack_index >= (is_main_function ? -(f.local_data_size + 1) : -(f.stack_frame_size + 1));
+}
+
+//checks a function's instructions: each has the operands its instruction set entry allows, every index points into
+//its table, the function's frame or the globals and jumps stay in the function
+static bool verify_function_code(const program_image& image, int function_index)
+{
+    int function_count = image.function_table.size();
+    int host_api_count = image.host_api_table.size();
+    int string_count = image.string_table.size();
+
+    const function& f = image.function_table[function_index];
+    for(int i = f.entry_point; i < f.code_end; ++i)
     {
-        bool is_still_active = false;
-        for(int i = 0; i < MAX_THREAD_COUNT; ++i)
+        const xvm_code& code = image.codes[i];
+        if(code.opcode < 0 || code.opcode > INSTR_EXIT)
+        {
+            return false;
+        }
+
+        const instruction_signature& signature = INSTRUCTION_SIGNATURES[code.opcode];
+        int operand_count = signature.operand_count;
+        if(code.opcode == INSTR_CALLHOST && code.opcount == operand_count + 1)
         {
-            if(scripts[i].is_active && scripts[i].is_running)
+            if(code.oplist[operand_count].type != OP_TYPE_INT || code.oplist[operand_count].int_literal < 0)
             {
-                is_still_active = true;
-                break;
+                return false;
             }
         }
-        if(!is_still_active)
+        else if(code.opcount != operand_count)
         {
-            break;
+            return false;
         }
 
-        current_time = get_current_time();
-
-        //check for a context switch if the threading mode is set for multithreading
-        if(current_thread_mode == THREAD_MODE_MULTI)
+        for(int j = 0; j < operand_count; ++j)
         {
-            if(current_time > current_thread_active_time + scripts[current_thread].timeslice_duration ||
-                !scripts[current_thread].is_running)
+            const xvm_operand& op = code.oplist[j];
+            if(!(get_operand_flag(op.type) & signature.operand_flags[j]))
             {
-                while(true)
-                {
-                    ++current_thread;
-                    if(current_thread >= MAX_THREAD_COUNT)
-                    {
-                        current_thread = 0;
-                    }
+                return false;
+            }
 
-                    if(scripts[current_thread].is_active && scripts[current_thread].is_running)
-                    {
-                        break;
-                    }
-                }
+            bool is_valid = true;
+            switch(op.type)
+            {
+            case OP_TYPE_STRING_INDEX:
+                is_valid = op.string_index >= 0 && op.string_index < string_count;
+                break;
+            case OP_TYPE_ABS_STACK_INDEX:
+                is_valid = is_stack_index_valid(image, function_index, op.stack_index);
+                break;
+            case OP_TYPE_REL_STACK_INDEX:
+                //the element itself is found at run time, the index variable and the array's base are checked here
+                is_valid = is_stack_index_valid(image, function_index, op.stack_index) && is_stack_index_valid(image, function_index, op.offset_index);
+                break;
+            case OP_TYPE_INSTR_INDEX:
+                is_valid = op.instruction_index >= f.entry_point && op.instruction_index < f.code_end;
+                break;
+            case OP_TYPE_FUNC_INDEX:
+                is_valid = op.function_index >= 0 && op.function_index < function_count;
+                break;
+            case OP_TYPE_HOST_API_CALL_INDEX:
+                is_valid = op.host_api_index >= 0 && op.host_api_index < host_api_count;
+                break;
+            }
+            if(!is_valid)
+            {
+                return false;
             }
         }
+    }
 
-        //is the script currently paused?
-        if(scripts[current_thread].is_paused)
+    return true;
+}
+
+//walks a function's code from its entry point like the assembler does and returns the most values it pushes at once.
+//every path must reach an instruction with the same number of values pushed, never take off more than it pushed and
+//end in Ret or Exit, code that doesn't is invalid. a host call without a parameter count makes the depth unknown.
+//each call is added to calls with the depth it's made at
+#define     STACK_DEPTH_INVALID     -2
+static int verify_operand_depth(const program_image& image, int function_index, std::vector<std::pair<int, int> >& calls)
+{
+    const function& f = image.function_table[function_index];
+    bool is_main_function = image.is_main_function_present && function_index == image.main_function_index;
+    std::vector<int> depths(f.code_end - f.entry_point, XSE2_STACK_DEPTH_UNKNOWN);
+    std::vector<int> pending;
+    depths[0] = 0;
+    pending.push_back(f.entry_point);
+
+    int max_depth = 0;
+    while(!pending.empty())
+    {
+        int code_index = pending.back();
+        pending.pop_back();
+
+        const xvm_code& code = image.codes[code_index];
+        int depth = depths[code_index - f.entry_point];
+        int next_code = code_index + 1;
+        int target_code = -1;
+
+        switch(code.opcode)
         {
-            if(current_time >= scripts[current_thread].pause_end_time)
+        case INSTR_PUSH:
+            ++depth;
+            break;
+        case INSTR_POP:
+            --depth;
+            break;
+        case INSTR_CALL:
+            calls.push_back(std::make_pair(code.oplist[0].function_index, depth));
+            depth -= image.function_table[code.oplist[0].function_index].param_count;
+            break;
+        case INSTR_CALLHOST:
+            if(code.opcount < 2)
             {
-                scripts[current_thread].is_paused = false;
+                return XSE2_STACK_DEPTH_UNKNOWN;
             }
-            else
+            depth -= code.oplist[1].int_literal;
+            break;
+        case INSTR_RET:
+            //_Main is entered without a caller to return to
+            if(is_main_function)
+            {
+                return STACK_DEPTH_INVALID;
+            }
+            next_code = -1;
+            break;
+        case INSTR_EXIT:
+            next_code = -1;
+            break;
+        case INSTR_JMP:
+            next_code = -1;
+            target_code = code.oplist[0].instruction_index;
+            break;
+        case INSTR_JE:
+        case INSTR_JNE:
+        case INSTR_JG:
+        case INSTR_JL:
+        case INSTR_JGE:
+        case INSTR_JLE:
+            target_code = code.oplist[2].instruction_index;
+            break;
+        }
+
+        if(depth < 0)
+        {
+            return STACK_DEPTH_INVALID;
+        }
+        if(depth > max_depth)
+        {
+            max_depth = depth;
+        }
+
+        int successors[2] = { next_code, target_code };
+        for(int i = 0; i < 2; ++i)
+        {
+            int successor = successors[i];
+            if(successor < 0)
             {
                 continue;
             }
+            if(successor >= f.code_end)
+            {
+                return STACK_DEPTH_INVALID;
+            }
+
+            if(depths[successor - f.entry_point] == XSE2_STACK_DEPTH_UNKNOWN)
+            {
+                depths[successor - f.entry_point] = depth;
+                pending.push_back(successor);
+            }
+            else if(depths[successor - f.entry_point] != depth)
+            {
+                return STACK_DEPTH_INVALID;
+            }
         }
+    }
 
-        //make a copy of the instruction pointer to compare later
-        int cc = scripts[current_thread].code_stream.current_code;
-        assert(cc < scripts[current_thread].code_stream.codes.size());
+    return max_depth;
+}
 
-        //get the current opcode
-        int opcode = scripts[current_thread].code_stream.codes[cc].opcode;
+//a function's frame plus the most its operands and calls stack on top of it, unknown if it may recurse or
+//takes more than MAX_VERIFIED_DATA_SIZE slots. states are 0 before a function is visited, 1 while its callees are and 2 after
+static int verify_stack_bound(const program_image& image, int function_index, const std::vector<std::vector<std::pair<int, int> > >& calls,
+                              std::vector<int>& states, std::vector<int>& bounds)
+{
+    if(states[function_index] == 2)
+    {
+        return bounds[function_index];
+    }
+    if(states[function_index] == 1)
+    {
+        return XSE2_STACK_DEPTH_UNKNOWN;
+    }
 
-        //execute the current instruction based on its opcode, as long as we aren't currently paused
-        switch(opcode)
+    states[function_index] = 1;
+    const function& f = image.function_table[function_index];
+    long long peak = f.operand_depth;
+    for(int i = 0; i < calls[function_index].size() && peak != XSE2_STACK_DEPTH_UNKNOWN; ++i)
+    {
+        int callee_bound = verify_stack_bound(image, calls[function_index][i].first, calls, states, bounds);
+        if(callee_bound == XSE2_STACK_DEPTH_UNKNOWN)
         {
-        //Move
-        case INSTR_MOV:
+            peak = XSE2_STACK_DEPTH_UNKNOWN;
+        }
+        else if(calls[function_index][i].second + (long long)callee_bound > peak)
+        {
+            peak = calls[function_index][i].second + (long long)callee_bound;
+        }
+    }
 
-        //Arithmetic Operations
-        case INSTR_ADD:
-        case INSTR_SUB:
-        case INSTR_MUL:
-        case INSTR_DIV:
-        case INSTR_MOD:
-        case INSTR_EXP:
+    long long bound = peak == XSE2_STACK_DEPTH_UNKNOWN ? XSE2_STACK_DEPTH_UNKNOWN : f.local_data_size + 2 + peak;
+    bounds[function_index] = bound > MAX_VERIFIED_DATA_SIZE ? XSE2_STACK_DEPTH_UNKNOWN : (int)bound;
+    states[function_index] = 2;
+    return bounds[function_index];
+}
 
-        //Bitwise Operations
-        case INSTR_AND:
-        case INSTR_OR:
-        case INSTR_XOR:
-        case INSTR_SHL:
-        case INSTR_SHR:
+//checks everything the interpreter takes for granted, so it can run the code without checking it again: the
+//function table, each function's code(verify_function_code) and that its stack effects balance. also works out the
+//stack depths, recorded_depths(when the executable has them) must agree with them.
+//a lazily loaded image only has its tables checked here, decode_function checks each function's code on its first call
+int xvm::verify_image(program_image& image, const xse2_stack_depth* recorded_depths)
+{
+    int code_count = image.codes.size();
+    int function_count = image.function_table.size();
+
+    if(image.global_data_size < 0 || image.global_data_size > MAX_VERIFIED_DATA_SIZE || image.stack_size <= 0)
+    {
+        return XS_LOAD_ERROR_INVALID_CODE;
+    }
+    if(image.is_main_function_present &&
+        (image.main_function_index < 0 || image.main_function_index >= function_count || image.function_table[image.main_function_index].param_count != 0))
+    {
+        return XS_LOAD_ERROR_INVALID_CODE;
+    }
+
+    //------------functions--------------//
+    //every instruction belongs to a function, which runs up to the next entry point
+    std::vector<int> function_starts(code_count, -1);
+    for(int i = 0; i < function_count; ++i)
+    {
+        const function& f = image.function_table[i];
+        if(f.entry_point < 0 || f.entry_point >= code_count || function_starts[f.entry_point] != -1 ||
+            f.param_count < 0 || f.local_data_size < 0 || f.param_count + f.local_data_size > MAX_VERIFIED_DATA_SIZE)
         {
-            xvm_value dest = resolve_operand_value(0);
-            xvm_value source = resolve_operand_value(1);
+            return XS_LOAD_ERROR_INVALID_CODE;
+        }
+        function_starts[f.entry_point] = i;
+    }
+    if(code_count > 0 && function_starts[0] == -1)
+    {
+        return XS_LOAD_ERROR_INVALID_CODE;
+    }
 
-            switch(opcode)
-            {
-            case INSTR_MOV:
-                if(resolve_operand_ptr(0) != resolve_operand_ptr(1))
-                {
-                    dest = source;
-                    //copy_value(&dest, source);
-                }
-                break;
-            case INSTR_ADD:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal += resolve_operand_as_int(1);
-                }
-                else
-                {
-                    dest.float_literal += resolve_operand_as_float(1);
-                }
-                break;
-            case INSTR_SUB:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal -= resolve_operand_as_int(1);
-                }
-                else
-                {
-                    dest.float_literal -= resolve_operand_as_float(1);
-                }
-                break;
-            case INSTR_MUL:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal *= resolve_operand_as_int(1);
-                }
-                else
-                {
-                    dest.float_literal *= resolve_operand_as_float(1);
-                }
-                break;
-            case INSTR_DIV:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal /= resolve_operand_as_int(1);
-                }
-                else
-                {
-                    dest.float_literal /= resolve_operand_as_float(1);
-                }
-                break;
-            case INSTR_MOD:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal %= resolve_operand_as_int(1);
-                }
-                break;
-            case INSTR_EXP:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal = static_cast<int>(pow(dest.int_literal, resolve_operand_as_int(1)));
-                }
-                else
-                {
-                    dest.float_literal = static_cast<float>(pow(dest.float_literal, resolve_operand_as_float(1)));
-                }
-                break;
-            case INSTR_AND:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal &= resolve_operand_as_int(1);
-                }
-                break;
-            case INSTR_OR:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal |= resolve_operand_as_int(1);
-                }
-                break;
-            case INSTR_XOR:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal ^= resolve_operand_as_int(1);
-                }
-                break;
-            case INSTR_SHL:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal <<= resolve_operand_as_int(1);
-                }
-                break;
-            case INSTR_SHR:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal >>= resolve_operand_as_int(1);
-                }
-                break;
-            }//switch(opcode)
-            *resolve_operand_ptr(0) = dest;
-            break;
+    //the checks need the functions' extents, which index_functions fills in for the interpreter later on
+    for(int i = 0; i < function_count; ++i)
+    {
+        image.function_table[i].code_end = code_count;
+    }
+    for(int i = 0, current_function = -1; i < code_count; ++i)
+    {
+        if(function_starts[i] == -1)
+        {
+            continue;
         }
-        //unary operations
-        case INSTR_NEG:
-        case INSTR_NOT:
-        case INSTR_INC:
-        case INSTR_DEC:
+        if(current_function >= 0)
+        {
+            image.function_table[current_function].code_end = i;
+        }
+        current_function = function_starts[i];
+    }
+
+    //the recorded depths stand in for the verifier's until each function is decoded and checked against its own.
+    //the program bound isn't checked at all, it only decides how much stack a reset hands out up front
+    if(image.encoded_codes)
+    {
+        image.is_stack_proven = recorded_depths != NULL;
+        for(int i = 0; i < function_count; ++i)
+        {
+            image.function_table[i].operand_depth = recorded_depths ? recorded_depths[i].operand_depth : XSE2_STACK_DEPTH_UNKNOWN;
+            image.is_stack_proven = image.is_stack_proven && image.function_table[i].operand_depth != XSE2_STACK_DEPTH_UNKNOWN;
+        }
+        image.stack_bound = recorded_depths && image.is_main_function_present ? recorded_depths[function_count].stack_bound : XSE2_STACK_DEPTH_UNKNOWN;
+        return XS_LOAD_OK;
+    }
+
+    //------------code and stack effects------------//
+    std::vector<std::vector<std::pair<int, int> > > calls(function_count);
+    image.is_stack_proven = true;
+    for(int i = 0; i < function_count; ++i)
+    {
+        if(!verify_function_code(image, i))
+        {
+            return XS_LOAD_ERROR_INVALID_CODE;
+        }
+
+        int operand_depth = verify_operand_depth(image, i, calls[i]);
+        if(operand_depth == STACK_DEPTH_INVALID || (recorded_depths && recorded_depths[i].operand_depth != operand_depth))
+        {
+            return XS_LOAD_ERROR_INVALID_CODE;
+        }
+
+        image.function_table[i].operand_depth = operand_depth;
+        image.is_stack_proven = image.is_stack_proven && operand_depth != XSE2_STACK_DEPTH_UNKNOWN;
+    }
+
+    //recorded bounds only have to agree where the verifier could work one out
+    std::vector<int> states(function_count, 0);
+    std::vector<int> bounds(function_count, XSE2_STACK_DEPTH_UNKNOWN);
+    for(int i = 0; i < function_count; ++i)
+    {
+        int bound = verify_stack_bound(image, i, calls, states, bounds);
+        if(recorded_depths && bound != XSE2_STACK_DEPTH_UNKNOWN && recorded_depths[i].stack_bound != bound)
+        {
+            return XS_LOAD_ERROR_INVALID_CODE;
+        }
+    }
+
+    //_Main's frame has no return address
+    image.stack_bound = XSE2_STACK_DEPTH_UNKNOWN;
+    if(image.is_main_function_present && bounds[image.main_function_index] != XSE2_STACK_DEPTH_UNKNOWN)
+    {
+        image.stack_bound = image.global_data_size + bounds[image.main_function_index] - 1;
+        if(recorded_depths && recorded_depths[function_count].stack_bound != image.stack_bound)
         {
-            xvm_value dest = resolve_operand_value(0);
+            return XS_LOAD_ERROR_INVALID_CODE;
+        }
+    }
+
+    return XS_LOAD_OK;
+}
+
+void xvm::release_image(program_image* image)
+{
+    if(--image->ref_count > 0)
+    {
+        return;
+    }
+
+    for(int i = 0; i < image->function_table.size(); ++i)
+    {
+        jit_release_function(*image, i);
+    }
+    if(image->file_mapping)
+    {
+        munmap(image->file_mapping, image->file_mapping_size);
+    }
+
+    for(int i = 0; i < images.size(); ++i)
+    {
+        if(images[i] == image)
+        {
+            images[i] = images.back();
+            images.pop_back();
+            break;
+        }
+    }
+    delete image;
+}
+
+void xvm::xvm_unload_script(int script_index)
+{
+    if(!is_thread_active(script_index))
+    {
+        return;
+    }
+
+    //the image goes with its last instance
+    release_image(scripts[script_index].image);
+    scripts[script_index].image = NULL;
+    scripts[script_index].code_stream.codes = NULL;
+
+    scripts[script_index].stack.elements.clear();
+    scripts[script_index].stack.high_water = 0;
+    scripts[script_index].host_api_bindings.clear();
+    scripts[script_index].string_table.clear();
+    scripts[script_index].string_buckets.clear();
+    scripts[script_index].string_hashes.clear();
+    scripts[script_index].string_builders.clear();
+    scripts[script_index].call_stack.clear();
+
+    //an idle pooled instance leaves its pool's list, so it can't be handed out after its slot is reused
+    if(scripts[script_index].is_pooled_idle)
+    {
+        std::vector<int>& idle_scripts = pools[scripts[script_index].pool_index].idle_scripts;
+        idle_scripts.erase(std::find(idle_scripts.begin(), idle_scripts.end(), script_index));
+        scripts[script_index].is_pooled_idle = false;
+    }
+
+    scripts[script_index].is_active = false;
+    scripts[script_index].is_running = false;
+    update_schedule(script_index);
+    scripts.release_slot(script_index);
+}
+
+void xvm::xvm_reset_script(int script_index)
+{
+    program_image& image = *scripts[script_index].image;
+    int main_function_index = image.main_function_index;
+
+    bool is_main_verified = true;
+    if(image.function_table.size() > 0)
+    {
+        if(image.is_main_function_present)
+        {
+            if(!__atomic_load_n(&image.function_table[main_function_index].is_decoded, __ATOMIC_ACQUIRE))
+            {
+                is_main_verified = decode_function(image, main_function_index);
+            }
+            scripts[script_index].code_stream.current_code = image.function_table[main_function_index].entry_point;
+        }
+    }
+
+    scripts[script_index].stack.top = 0;
+    scripts[script_index].stack.frame = 0;
+    scripts[script_index].call_stack.clear();
+    scripts[script_index].runtime_error = XS_RUNTIME_OK;
+
+    //nothing refers to the strings of the last run once the stack is cleared. the vectors keep their memory
+    script& s = scripts[script_index];
+    s._RetVal.type = OP_TYPE_NULL;
+    s.string_table.clear();
+    s.string_hashes.clear();
+    s.string_buckets.clear();
+    s.string_builders.clear();
+    s.string_gc_threshold = get_string_gc_threshold(s.pinned_string_count);
+
+    scripts[script_index].is_paused = false;
+    update_schedule(script_index);
+
+    //only the slots used since the last reset need clearing, the stack keeps its memory and starts
+    //over with the whole run's bound handed out when it is known, otherwise with the globals and _Main's frame
+    runtime_stack& stack = scripts[script_index].stack;
+    for(int i = 0; i < stack.high_water; ++i)
+    {
+        stack.elements[i].type = OP_TYPE_NULL;
+    }
+    stack.high_water = 0;
+
+    //a script without _Main only runs the functions its host calls
+    int main_frame_size = 0;
+    int main_operand_depth = 0;
+    if(image.is_main_function_present)
+    {
+        main_frame_size = image.function_table[main_function_index].local_data_size + 1;
+        main_operand_depth = image.function_table[main_function_index].operand_depth;
+    }
+
+    //a lazily loaded image's bound is the recorded one, it's only taken when it covers _Main's own operands
+    int reserve_size = image.global_data_size + main_frame_size;
+    if(main_operand_depth != XSE2_STACK_DEPTH_UNKNOWN)
+    {
+        reserve_size += main_operand_depth;
+    }
+    if(image.stack_bound != XSE2_STACK_DEPTH_UNKNOWN && image.stack_bound > reserve_size && image.stack_bound <= stack.size)
+    {
+        reserve_size = image.stack_bound;
+    }
+    if(!grow_stack(script_index, reserve_size))
+    {
+        return;
+    }
+
+    //allocate space for the globals
+    push_frame(script_index, image.global_data_size);
+
+    //if _Main() is present, push its stack frame
+    push_frame(script_index, main_frame_size);
+
+    //code that fails the verification is never run, the script can't be started
+    if(!is_main_verified)
+    {
+        raise_script_error(script_index, XS_RUNTIME_ERROR_INVALID_CODE);
+    }
+}
+
+int xvm::xvm_get_script_error(int script_index)
+{
+    if(!is_thread_active(script_index))
+    {
+        return XS_RUNTIME_OK;
+    }
+
+    return scripts[script_index].runtime_error;
+}
+
+int xvm::xvm_create_script_pool(const char* script_name, int instance_count, int thread_timeslice, int& pool_index)
+{
+    //reuse the slot of a destroyed pool once all of its instances are gone
+    pool_index = pools.size();
+    for(int i = 0; i < pools.size(); ++i)
+    {
+        if(!pools[i].is_active && pools[i].idle_scripts.empty())
+        {
+            bool is_in_use = false;
+            for(int j = 0; j < scripts.size() && !is_in_use; ++j)
+            {
+                is_in_use = scripts[j].is_active && scripts[j].pool_index == i;
+            }
+            if(!is_in_use)
+            {
+                pool_index = i;
+                break;
+            }
+        }
+    }
+    if(pool_index == pools.size())
+    {
+        pools.push_back(script_pool());
+    }
+
+    script_pool& pool = pools[pool_index];
+    pool.is_active = true;
+    pool.file_name = script_name;
+    pool.thread_timeslice = thread_timeslice;
+    pool.idle_scripts.clear();
+
+    //load the instances up front, the pool is only created if all of them load
+    for(int i = 0; i < instance_count; ++i)
+    {
+        int script_index;
+        int error_code = xvm_load_script(script_name, script_index, thread_timeslice);
+        if(error_code != XS_LOAD_OK)
+        {
+            xvm_destroy_script_pool(pool_index);
+            pool_index = -1;
+            return error_code;
+        }
+
+        scripts[script_index].pool_index = pool_index;
+        scripts[script_index].is_pooled_idle = true;
+        pools[pool_index].idle_scripts.push_back(script_index);
+    }
+
+    return XS_LOAD_OK;
+}
+
+void xvm::xvm_destroy_script_pool(int pool_index)
+{
+    if(pool_index < 0 || pool_index >= pools.size() || !pools[pool_index].is_active)
+    {
+        return;
+    }
+
+    script_pool& pool = pools[pool_index];
+    pool.is_active = false;
+    while(!pool.idle_scripts.empty())
+    {
+        //unloading an idle instance takes it off the list
+        xvm_unload_script(pool.idle_scripts.back());
+    }
+}
+
+int xvm::xvm_acquire_script(int pool_index)
+{
+    if(pool_index < 0 || pool_index >= pools.size() || !pools[pool_index].is_active)
+    {
+        return -1;
+    }
+
+    script_pool& pool = pools[pool_index];
+    if(!pool.idle_scripts.empty())
+    {
+        int script_index = pool.idle_scripts.back();
+        pool.idle_scripts.pop_back();
+        scripts[script_index].is_pooled_idle = false;
+        return script_index;
+    }
+
+    //every instance is taken, the pool grows by one
+    int script_index;
+    if(xvm_load_script(pool.file_name.c_str(), script_index, pool.thread_timeslice) != XS_LOAD_OK)
+    {
+        return -1;
+    }
+    scripts[script_index].pool_index = pool_index;
+
+    return script_index;
+}
+
+void xvm::xvm_release_script(int script_index)
+{
+    //an instance already back in its pool would be handed out twice
+    if(!is_thread_active(script_index) || scripts[script_index].is_pooled_idle)
+    {
+        return;
+    }
+
+    int pool_index = scripts[script_index].pool_index;
+    if(pool_index < 0 || !pools[pool_index].is_active)
+    {
+        xvm_unload_script(script_index);
+        return;
+    }
+
+    //back to the state xvm_acquire_script hands instances out in
+    scripts[script_index].is_running = false;
+    xvm_reset_script(script_index);
+    scripts[script_index].is_pooled_idle = true;
+    pools[pool_index].idle_scripts.push_back(script_index);
+}
+
+void xvm::xvm_run_script(int timeslice_duration)
+{
+    ++worker().run_depth;
+    if(worker_count > 1 && get_worker_index() == 0 && worker().run_depth == 1 && worker().current_thread_mode == THREAD_MODE_MULTI)
+    {
+        //only the host's own top level call is spread over the pool, re-entries run where they are
+        execute_parallel(timeslice_duration);
+    }
+    else if(exec_engine == XS_EXEC_ENGINE_THREADED)
+    {
+        execute_threaded(timeslice_duration);
+    }
+    else
+    {
+        execute_switch(timeslice_duration);
+    }
+    --worker().run_depth;
+
+    //collect strings between timeslices, but not while a host function has re-entered the VM
+    if(get_worker_index() == 0 && worker().run_depth == 0)
+    {
+        collect_strings_step();
+    }
+}
+
+void xvm::xvm_set_worker_count(int count)
+{
+    stop_workers();
+    start_workers(count < 1 ? 1 : count > MAX_WORKER_COUNT ? MAX_WORKER_COUNT : count);
+}
+
+void xvm::start_workers(int count)
+{
+    worker_count = count;
+    is_pool_stopping = false;
+    for(int i = 1; i < worker_count; ++i)
+    {
+        //the round is read here, a thread that starts late must still join the host's first round
+        pool_threads.push_back(std::thread(&xvm::worker_main, this, i, pool_round));
+    }
+}
+
+void xvm::stop_workers()
+{
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        is_pool_stopping = true;
+    }
+    pool_cond.notify_all();
+
+    for(int i = 0; i < pool_threads.size(); ++i)
+    {
+        pool_threads[i].join();
+    }
+    pool_threads.clear();
+    worker_count = 1;
+}
+
+void xvm::worker_main(int index, int round)
+{
+    worker_owner = this;
+    worker_index = index;
+
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    while(true)
+    {
+        while(pool_round == round && !is_pool_stopping)
+        {
+            pool_cond.wait(lock);
+        }
+        if(is_pool_stopping)
+        {
+            return;
+        }
+        round = pool_round;
+
+        int timeslice_duration = pool_timeslice;
+        lock.unlock();
+        run_worker(timeslice_duration);
+        lock.lock();
+
+        if(--pool_busy_count == 0)
+        {
+            pool_done_cond.notify_all();
+        }
+    }
+}
+
+void xvm::execute_parallel(int timeslice_duration)
+{
+    int main_timeslice_start_time = get_current_time();
+
+    //every ready script gets one burst per round, then the host's thread wakes sleepers and deals again
+    while(true)
+    {
+        int current_time = get_current_time();
+        advance_timers(current_time);
+
+        int script_count = 0;
+        if(ready_head >= 0)
+        {
+            int script_index = ready_head;
+            do
+            {
+                workers[script_count % worker_count].work.push_back(script_index);
+                ++script_count;
+                script_index = scripts[script_index].schedule_next;
+            } while(script_index != ready_head);
+        }
+
+        if(script_count == 0)
+        {
+            //every script is sleeping, or none is running at all
+            if(sleeping_count == 0 || !wait_for_wake(main_timeslice_start_time, timeslice_duration))
+            {
+                break;
+            }
+            continue;
+        }
+
+        int remaining_time = XS_INFINITE_TIMESLICE;
+        if(timeslice_duration != XS_INFINITE_TIMESLICE)
+        {
+            remaining_time = main_timeslice_start_time + timeslice_duration - current_time;
+            remaining_time = remaining_time > 0 ? remaining_time : 0;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            pool_timeslice = remaining_time;
+            pool_busy_count = worker_count - 1;
+            is_pool_round_running = true;
+            ++pool_round;
+        }
+        pool_cond.notify_all();
+
+        //the host's thread works as worker 0, then waits for the rest of the round
+        run_worker(remaining_time);
+        {
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            while(pool_busy_count > 0)
+            {
+                pool_done_cond.wait(lock);
+            }
+            is_pool_round_running = false;
+        }
+
+        //nothing runs now, so the code the workers found hot can be patched
+        jit_process_requests();
+
+        if(timeslice_duration != XS_INFINITE_TIMESLICE &&
+           get_current_time() > main_timeslice_start_time + timeslice_duration)
+        {
+            break;
+        }
+    }
+}
+
+void xvm::run_worker(int timeslice_duration)
+{
+    xvm_worker& w = worker();
+    int thread_mode = w.current_thread_mode;
+
+    for(int script_index = take_work(); script_index >= 0; script_index = take_work())
+    {
+        //one burst, until the script's own timeslice is over or it pauses or stops
+        w.current_thread = script_index;
+        w.current_thread_mode = THREAD_MODE_WORKER;
+        w.current_thread_active_time = get_current_time();
+        w.thread_fuel = get_thread_fuel(script_index);
+
+        if(exec_engine == XS_EXEC_ENGINE_THREADED)
+        {
+            execute_threaded(timeslice_duration);
+        }
+        else
+        {
+            execute_switch(timeslice_duration);
+        }
+    }
+
+    w.current_thread_mode = thread_mode;
+}
+
+int xvm::take_work()
+{
+    //the worker's own queue first
+    xvm_worker& w = worker();
+    {
+        std::lock_guard<std::mutex> lock(w.work_mutex);
+        if(!w.work.empty())
+        {
+            int script_index = w.work.back();
+            w.work.pop_back();
+            return script_index;
+        }
+    }
+
+    //then steal from the others, from the end their owners take last
+    for(int i = 1; i < worker_count; ++i)
+    {
+        xvm_worker& victim = workers[(get_worker_index() + i) % worker_count];
+        std::lock_guard<std::mutex> lock(victim.work_mutex);
+        if(!victim.work.empty())
+        {
+            int script_index = victim.work.front();
+            victim.work.pop_front();
+            return script_index;
+        }
+    }
+
+    return -1;
+}
+
+void xvm::execute_switch(int timeslice_duration)
+{
+    //begin a loop that runs until a keypress. the instruction pointer has already been
+    //initialized with a prior call to reset_script(), so execution can begin
+
+    int is_exit_execute_loop = false;
+    int main_timeslice_start_time = get_current_time();
+    int current_time = main_timeslice_start_time;
+    long long run_fuel = get_run_fuel(timeslice_duration);
+
+    while(true)
+    {
+        //in fuel mode the clock is only read once the thread's budget is used up
+        if(timeslice_mode == XS_TIMESLICE_CLOCK || worker().thread_fuel <= 0)
+        {
+            current_time = get_current_time();
+        }
+
+        //pick the thread, switching when the current one's timeslice is over
+        int schedule = schedule_thread(current_time);
+        if(schedule == SCHEDULE_DONE)
+        {
+            break;
+        }
+        if(schedule == SCHEDULE_IDLE)
+        {
+            //every script is sleeping
+            if(!wait_for_wake(main_timeslice_start_time, timeslice_duration))
+            {
+                break;
+            }
+            continue;
+        }
+
+        execute_instruction(current_time, is_exit_execute_loop);
+
+        if(timeslice_mode == XS_TIMESLICE_FUEL)
+        {
+            charge_fuel(1, run_fuel);
+            if(run_fuel == 0)
+            {
+                break;
+            }
+        }
+        else if(timeslice_duration != XS_INFINITE_TIMESLICE)
+        {
+            if(current_time > main_timeslice_start_time + timeslice_duration)
+            {
+                break;
+            }
+        }
+
+        if(is_exit_execute_loop)
+        {
+            break;
+        }
+    }
+}
+
+void xvm::execute_instruction(int current_time, int& is_exit_execute_loop)
+{
+    int current_thread = worker().current_thread;
+    script& s = scripts[current_thread];
+
+    //make a copy of the instruction pointer to compare later. the verifier has made sure it stays
+    //inside the code and every instruction has the operands it reads, so neither is checked here
+    int cc = s.code_stream.current_code;
+
+    //get the current opcode
+    int opcode = s.code_stream.codes[cc].opcode;
+
+    //execute the current instruction based on its opcode, as long as we aren't currently paused
+    switch(opcode)
+    {
+    //Move
+    case INSTR_MOV:
+
+    //Arithmetic Operations
+    case INSTR_ADD:
+    case INSTR_SUB:
+    case INSTR_MUL:
+    case INSTR_DIV:
+    case INSTR_MOD:
+    case INSTR_EXP:
+
+    //Bitwise Operations
+    case INSTR_AND:
+    case INSTR_OR:
+    case INSTR_XOR:
+    case INSTR_SHL:
+    case INSTR_SHR:
+    {
+        xvm_value dest = resolve_operand_value(0);
+        xvm_value source = resolve_operand_value(1);
+
+        switch(opcode)
+        {
+        case INSTR_MOV:
+            if(resolve_operand_ptr(0) != resolve_operand_ptr(1))
+            {
+                dest = source;
+                //copy_value(&dest, source);
+            }
+            break;
+        case INSTR_ADD:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal += resolve_operand_as_int(1);
+            }
+            else
+            {
+                dest.float_literal += resolve_operand_as_float(1);
+            }
+            break;
+        case INSTR_SUB:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal -= resolve_operand_as_int(1);
+            }
+            else
+            {
+                dest.float_literal -= resolve_operand_as_float(1);
+            }
+            break;
+        case INSTR_MUL:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal *= resolve_operand_as_int(1);
+            }
+            else
+            {
+                dest.float_literal *= resolve_operand_as_float(1);
+            }
+            break;
+        case INSTR_DIV:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal /= resolve_operand_as_int(1);
+            }
+            else
+            {
+                dest.float_literal /= resolve_operand_as_float(1);
+            }
+            break;
+        case INSTR_MOD:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal %= resolve_operand_as_int(1);
+            }
+            break;
+        case INSTR_EXP:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal = static_cast<int>(pow(dest.int_literal, resolve_operand_as_int(1)));
+            }
+            else
+            {
+                dest.float_literal = static_cast<float>(pow(dest.float_literal, resolve_operand_as_float(1)));
+            }
+            break;
+        case INSTR_AND:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal &= resolve_operand_as_int(1);
+            }
+            break;
+        case INSTR_OR:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal |= resolve_operand_as_int(1);
+            }
+            break;
+        case INSTR_XOR:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal ^= resolve_operand_as_int(1);
+            }
+            break;
+        case INSTR_SHL:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal <<= resolve_operand_as_int(1);
+            }
+            break;
+        case INSTR_SHR:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal >>= resolve_operand_as_int(1);
+            }
+            break;
+        }//switch(opcode)
+        *resolve_operand_ptr(0) = dest;
+        break;
+    }
+    //unary operations
+    case INSTR_NEG:
+    case INSTR_NOT:
+    case INSTR_INC:
+    case INSTR_DEC:
+    {
+        xvm_value dest = resolve_operand_value(0);
+
+        switch(opcode)
+        {
+        case INSTR_NEG:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal = -dest.int_literal;
+            }
+            else
+            {
+                dest.float_literal = -dest.float_literal;
+            }
+            break;
+        case INSTR_NOT:
+            if(dest.type == OP_TYPE_INT)
+            {
+                dest.int_literal = ~dest.int_literal;
+            }
+            break;
+        case INSTR_INC:
+            if(dest.type == OP_TYPE_INT)
+            {
+                ++dest.int_literal;
+            }
+            else
+            {
+                ++dest.float_literal;
+            }
+            break;
+        case INSTR_DEC:
+            if(dest.type == OP_TYPE_INT)
+            {
+                --dest.int_literal;
+            }
+            else
+            {
+                --dest.float_literal;
+            }
+            break;
+        }//switch(opcode)
+        *resolve_operand_ptr(0) = dest;
+        break;
+    }
+    case INSTR_CONCAT:
+    {
+        xvm_value dest = resolve_operand_value(0);
+        string source_string = resolve_operand_as_string(1);
+
+        concat_string(current_thread, dest, source_string);
+
+        *resolve_operand_ptr(0) = dest;
+        break;
+    }
+    case INSTR_GETCHAR:
+    {
+        xvm_value dest = resolve_operand_value(0);
+        xvm_value source = resolve_operand_value(1);
+        int source_index = resolve_operand_as_int(2);
+
+        char ch[2];
+        ch[0] = get_string_char(current_thread, source, source_index);
+        ch[1] = '\0';
+        dest.type = OP_TYPE_STRING_INDEX;
+        dest.string_index = add_string_if_new(current_thread, ch);
+
+        *resolve_operand_ptr(0) = dest;
+        break;
+    }
+    case INSTR_SETCHAR:
+    {
+        flatten_string(current_thread, *resolve_operand_ptr(0));
+        if(resolve_operand_type(0) != OP_TYPE_STRING_INDEX)
+        {
+            break;
+        }
+
+        int dest_index = resolve_operand_as_int(1);
+        string source_string = resolve_operand_as_string(2);
+
+        //strings are interned and shared, so write to a copy
+        xvm_value* dest = resolve_operand_ptr(0);
+        string new_string = get_script_string(s, dest->string_index);
+        if(dest_index >= 0 && dest_index < new_string.size())
+        {
+            new_string[dest_index] = source_string[0];
+            dest->string_index = add_string_if_new(current_thread, new_string);
+        }
+        break;
+    }
+    case INSTR_JMP:
+    {
+        int target_index = resolve_operand_as_instruction_index(0);
+        s.code_stream.current_code = target_index;
+        break;
+    }
+    case INSTR_JE:
+    case INSTR_JNE:
+    case INSTR_JG:
+    case INSTR_JL:
+    case INSTR_JGE:
+    case INSTR_JLE:
+    {
+        xvm_value v0 = resolve_operand_value(0);
+        xvm_value v1 = resolve_operand_value(1);
+        int target_index = resolve_operand_as_instruction_index(2);
+        bool is_jump = false;
+
+        //strings being built are compared by their contents
+        if(IS_STRING_BUILDER(v0.type) || (v0.type == OP_TYPE_STRING_INDEX && IS_STRING_BUILDER(v1.type)))
+        {
+            flatten_string(current_thread, v0);
+            flatten_string(current_thread, v1);
+        }
+
+        switch(opcode)
+        {
+        case INSTR_JE:
+            switch(v0.type)
+            {
+            case OP_TYPE_INT:
+                is_jump = v0.int_literal == v1.int_literal ? true : false;
+                break;
+            case OP_TYPE_FLOAT:
+                is_jump = v0.float_literal == v1.float_literal ? true : false;
+                break;
+            case OP_TYPE_STRING_INDEX:
+            {
+                const string& s0 = get_script_string(s, v0.string_index);
+                const string& s1 = get_script_string(s, v1.string_index);
+                is_jump = s0 == s1 ? true : false;
+                break;
+            }
+            }
+            break;
+        case INSTR_JNE:
+            switch(v0.type)
+            {
+            case OP_TYPE_INT:
+                is_jump = v0.int_literal != v1.int_literal ? true : false;
+                break;
+            case OP_TYPE_FLOAT:
+                is_jump = v0.float_literal != v1.float_literal ? true : false;
+                break;
+            case OP_TYPE_STRING_INDEX:
+            {
+                const string& s0 = get_script_string(s, v0.string_index);
+                const string& s1 = get_script_string(s, v1.string_index);
+                is_jump = s0 != s1 ? true : false;
+                break;
+            }
+            }
+            break;
+        case INSTR_JG:
+            switch(v0.type)
+            {
+            case OP_TYPE_INT:
+                is_jump = v0.int_literal > v1.int_literal ? true : false;
+                break;
+            case OP_TYPE_FLOAT:
+                is_jump = v0.float_literal > v1.float_literal ? true : false;
+                break;
+            }
+            break;
+        case INSTR_JL:
+            switch(v0.type)
+            {
+            case OP_TYPE_INT:
+                is_jump = v0.int_literal < v1.int_literal ? true : false;
+                break;
+            case OP_TYPE_FLOAT:
+                is_jump = v0.float_literal < v1.float_literal ? true : false;
+                break;
+            }
+            break;
+        case INSTR_JGE:
+            switch(v0.type)
+            {
+            case OP_TYPE_INT:
+                is_jump = v0.int_literal >= v1.int_literal ? true : false;
+                break;
+            case OP_TYPE_FLOAT:
+                is_jump = v0.float_literal >= v1.float_literal ? true : false;
+                break;
+            }
+            break;
+        case INSTR_JLE:
+            switch(v0.type)
+            {
+            case OP_TYPE_INT:
+                is_jump = v0.int_literal <= v1.int_literal ? true : false;
+                break;
+            case OP_TYPE_FLOAT:
+                is_jump = v0.float_literal <= v1.float_literal ? true : false;
+                break;
+            }
+            break;
+        }//opcode
+
+        if(is_jump)
+        {
+            s.code_stream.current_code = target_index;
+        }
+
+        break;
+    }
+    case INSTR_PUSH:
+    {
+        xvm_value v = resolve_operand_value(0);
+        push(current_thread, v);
+        break;
+    }
+    case INSTR_POP:
+    {
+        //only images the loader couldn't prove balanced can pop past the frame
+        if(!s.image->is_stack_proven && s.stack.top <= s.stack.frame)
+        {
+            raise_script_error(current_thread, XS_RUNTIME_ERROR_STACK_UNDERFLOW);
+            break;
+        }
+        *resolve_operand_ptr(0) = pop(current_thread);
+        break;
+    }
+    case INSTR_CALL:
+    {
+        int function_index = resolve_operand_as_function_index(0);
+
+        //advance the instruction pointer so it points to the instruction immediately following the call
+        ++s.code_stream.current_code;
+        call_function(current_thread, function_index);
+        break;
+    }
+    case INSTR_RET:
+    {
+        const call_frame& frame = s.call_stack.back();
+
+        //check for the presence of a stack base marker
+        if(frame.is_stack_base)
+        {
+            is_exit_execute_loop = true;
+        }
+
+        //pop the frame record, then the stack frame along with the return address
+        s.stack.top = s.stack.frame - 1 - frame.callee->stack_frame_size;
+
+        //restore the previous frame index and make the jump to the return address
+        s.stack.frame = frame.saved_frame;
+        s.code_stream.current_code = frame.return_code;
+        s.call_stack.pop_back();
+        break;
+    }
+    case INSTR_CALLHOST:
+    {
+        xvm_value host_api_call = resolve_operand_value(0);
+        const host_api_binding& host_api = s.host_api_bindings[host_api_call.host_api_index];
+        //the stack depths count on the call taking off the parameters the compiler says it passed
+        int param_count = s.code_stream.codes[cc].opcount > 1 ? resolve_operand_as_int(1) : -1;
+        int top = s.stack.top;
+        int frame = s.stack.frame;
+        if(top - param_count < frame)
+        {
+            raise_script_error(current_thread, XS_RUNTIME_ERROR_STACK_UNDERFLOW);
+            break;
+        }
+        if(host_api.function != NULL)
+        {
+            host_api.function(this, current_thread, host_api.user_data);
+        }
+
+        if(param_count >= 0 && cc == s.code_stream.current_code && frame == s.stack.frame)
+        {
+            s.stack.top = top - param_count;
+        }
+        break;
+    }
+    case INSTR_PAUSE:
+    {
+        //current_time can be a whole budget old in fuel mode
+        int pause_duration = resolve_operand_as_int(0);
+        s.pause_end_time = get_current_time() + pause_duration;
+        s.is_paused = true;
+        update_schedule(current_thread);
+        break;
+    }
+    case INSTR_EXIT:
+    {
+        xvm_value exit_code = resolve_operand_value(0);
+        int ec = exit_code.int_literal;
+        s.is_running = false;
+        update_schedule(current_thread);
+        break;
+    }
+
+    //superinstructions, the rest of the fused sequence follows the head and supplies the operands
+    case INSTR_PUSH_POP:
+    case INSTR_PUSH_PAIR:
+    case INSTR_CMP_PUSH:
+    case INSTR_CMP_BRANCH:
+    {
+        const xvm_code* code = &s.code_stream.codes[cc];
+        int next_code = cc + SUPER_INSTRUCTION_LENGTH[opcode - INSTR_SUPER_FIRST];
+
+        xvm_value v0 = threaded_operand_value(s, code[0].oplist[0]);
+        if(opcode == INSTR_PUSH_POP)
+        {
+            *threaded_operand_ptr(s, code[1].oplist[0]) = v0;
+        }
+        else
+        {
+            xvm_value v1 = threaded_operand_value(s, code[1].oplist[0]);
+            *threaded_operand_ptr(s, code[2].oplist[0]) = v1;
+            *threaded_operand_ptr(s, code[3].oplist[0]) = v0;
+
+            if(opcode != INSTR_PUSH_PAIR)
+            {
+                xvm_value result;
+                result.type = OP_TYPE_INT;
+                result.int_literal = is_jump_taken(s, code[4].opcode, v0, v1);
+
+                if(opcode == INSTR_CMP_PUSH)
+                {
+                    push(current_thread, result);
+                }
+                else
+                {
+                    *threaded_operand_ptr(s, code[8].oplist[0]) = result;
+                    if(!result.int_literal)
+                    {
+                        next_code = code[9].oplist[2].instruction_index;
+                    }
+                }
+            }
+        }
+
+        s.code_stream.current_code = next_code;
+        break;
+    }
+    }//switch(opcode)
+
+    if(cc == s.code_stream.current_code)
+    {
+        ++s.code_stream.current_code;
+    }
+}
+
+inline xvm_value* xvm::threaded_operand_ptr(script& s, const xvm_operand& op)
+{
+    switch(op.type)
+    {
+    case OP_TYPE_ABS_STACK_INDEX:
+        return &s.stack.elements[op.stack_index < 0 ? op.stack_index + s.stack.frame : op.stack_index];
+    case OP_TYPE_REL_STACK_INDEX:
+    {
+        //the verifier can only check the array's base and index variable, the index itself has to stay in the stack in use
+        int offset_index = op.offset_index < 0 ? op.offset_index + s.stack.frame : op.offset_index;
+        int stack_index = op.stack_index + s.stack.elements[offset_index].int_literal;
+        stack_index = stack_index < 0 ? stack_index + s.stack.frame : stack_index;
+        if((unsigned int)stack_index >= (unsigned int)s.stack.top)
+        {
+            return raise_index_error(s);
+        }
+
+        return &s.stack.elements[stack_index];
+    }
+    case OP_TYPE_REG:
+        return &s._RetVal;
+    }
+
+    return NULL;
+}
+
+inline xvm_value xvm::threaded_operand_value(script& s, const xvm_operand& op)
+{
+    switch(op.type)
+    {
+    case OP_TYPE_ABS_STACK_INDEX:
+    case OP_TYPE_REL_STACK_INDEX:
+    case OP_TYPE_REG:
+        return *threaded_operand_ptr(s, op);
+    default:
+        return op;
+    }
+}
+
+inline bool xvm::is_jump_taken(script& s, int opcode, const xvm_value& v0, const xvm_value& v1)
+{
+    //strings being built are compared by their contents
+    if(IS_STRING_BUILDER(v0.type) || (v0.type == OP_TYPE_STRING_INDEX && IS_STRING_BUILDER(v1.type)))
+    {
+        xvm_value f0 = v0;
+        xvm_value f1 = v1;
+        flatten_string(worker().current_thread, f0);
+        flatten_string(worker().current_thread, f1);
+        return is_jump_taken(s, opcode, f0, f1);
+    }
+
+    switch(v0.type)
+    {
+    case OP_TYPE_INT:
+        switch(opcode)
+        {
+        case INSTR_JE:  return v0.int_literal == v1.int_literal;
+        case INSTR_JNE: return v0.int_literal != v1.int_literal;
+        case INSTR_JG:  return v0.int_literal > v1.int_literal;
+        case INSTR_JL:  return v0.int_literal < v1.int_literal;
+        case INSTR_JGE: return v0.int_literal >= v1.int_literal;
+        case INSTR_JLE: return v0.int_literal <= v1.int_literal;
+        }
+        break;
+    case OP_TYPE_FLOAT:
+        switch(opcode)
+        {
+        case INSTR_JE:  return v0.float_literal == v1.float_literal;
+        case INSTR_JNE: return v0.float_literal != v1.float_literal;
+        case INSTR_JG:  return v0.float_literal > v1.float_literal;
+        case INSTR_JL:  return v0.float_literal < v1.float_literal;
+        case INSTR_JGE: return v0.float_literal >= v1.float_literal;
+        case INSTR_JLE: return v0.float_literal <= v1.float_literal;
+        }
+        break;
+    case OP_TYPE_STRING_INDEX:
+        //strings only support equality tests
+        switch(opcode)
+        {
+        case INSTR_JE:  return get_script_string(s, v0.string_index) == get_script_string(s, v1.string_index);
+        case INSTR_JNE: return get_script_string(s, v0.string_index) != get_script_string(s, v1.string_index);
+        }
+        break;
+    }
+
+    return false;
+}
+
+void xvm::execute_threaded(int timeslice_duration, void* const** dispatch_table)
+{
+#if XVM_HAS_COMPUTED_GOTO
+    //handler addresses indexed by opcode(superinstructions included), then a catch-all for unknown opcodes,
+    //then the quickened variants indexed by XVM_QUICK_HANDLER_BASE + quick opcode,
+    //then the JIT entry handler and the pushes proven images run without the stack check
+    static void* const handlers[XVM_HANDLER_COUNT] =
+    {
+        &&op_mov,
+        &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_mod, &&op_exp, &&op_neg, &&op_inc, &&op_dec,
+        &&op_and, &&op_or, &&op_xor, &&op_not, &&op_shl, &&op_shr,
+        &&op_concat, &&op_getchar, &&op_setchar,
+        &&op_jmp, &&op_je, &&op_jne, &&op_jg, &&op_jl, &&op_jge, &&op_jle,
+        &&op_push, &&op_pop,
+        &&op_call, &&op_ret, &&op_callhost,
+        &&op_pause, &&op_exit,
+        &&op_push_pop, &&op_push_pair, &&op_cmp_push, &&op_cmp_branch,
+        &&op_nop,
+
+        &&q_mov_stack_stack, &&q_mov_stack_literal, &&q_mov_stack_reg, &&q_mov_reg_stack,
+        &&q_add_stack_stack, &&q_add_stack_int, &&q_sub_stack_stack, &&q_sub_stack_int,
+        &&q_mul_stack_stack, &&q_mul_stack_int, &&q_inc_stack, &&q_dec_stack,
+        &&q_je_stack_stack, &&q_je_stack_int, &&q_jne_stack_stack, &&q_jne_stack_int,
+        &&q_jg_stack_stack, &&q_jg_stack_int, &&q_jl_stack_stack, &&q_jl_stack_int,
+        &&q_jge_stack_stack, &&q_jge_stack_int, &&q_jle_stack_stack, &&q_jle_stack_int,
+        &&q_push_stack, &&q_push_literal, &&q_push_reg, &&q_pop_stack, &&q_pop_reg,
+
+        &&op_jit_enter,
+
+        &&op_push_unchecked, &&op_cmp_push_unchecked,
+        &&op_pop_unchecked,
+        &&q_push_stack_unchecked, &&q_push_literal_unchecked, &&q_push_reg_unchecked,
+        &&q_pop_stack_unchecked, &&q_pop_reg_unchecked,
+    };
+
+    if(dispatch_table)
+    {
+        *dispatch_table = handlers;
+        return;
+    }
+
+    int is_exit_execute_loop = false;
+    int main_timeslice_start_time = get_current_time();
+    int current_time = main_timeslice_start_time;
+    long long run_fuel = get_run_fuel(timeslice_duration);
+
+    //unlike the switch loop, which re-checks the scheduler before every instruction, this loop
+    //runs a thread in bursts and only consults the clock(or charges fuel) at back edges and calls
+    while(true)
+    {
+        if(timeslice_mode == XS_TIMESLICE_CLOCK || worker().thread_fuel <= 0)
+        {
+            current_time = get_current_time();
+        }
+
+        //pick the thread, switching when the current one's timeslice is over
+        int schedule = schedule_thread(current_time);
+        if(schedule == SCHEDULE_DONE)
+        {
+            break;
+        }
+        if(schedule == SCHEDULE_IDLE)
+        {
+            //every script is sleeping
+            if(!wait_for_wake(main_timeslice_start_time, timeslice_duration))
+            {
+                break;
+            }
+            continue;
+        }
+
+        //run the current thread until it reaches a safe point
+        script& s = scripts[worker().current_thread];
+        xvm_code* codes = &s.code_stream.codes[0];
+        xvm_code* code = codes + s.code_stream.current_code;
+        int branch_target;
+
+#define DISPATCH()              goto *code->handler
+#define NEXT()                  { ++code; DISPATCH(); }
+#define OPERAND(index)          (code->oplist[index])
+#define BRANCH(target)          { branch_target = (target); if(branch_target <= code - codes) goto back_edge; code = codes + branch_target; DISPATCH(); }
+#define STACK_OPERAND(index)    (&s.stack.elements[OPERAND(index).stack_index < 0 ? OPERAND(index).stack_index + s.stack.frame : OPERAND(index).stack_index])
+#define RESERVE_PUSH()          if(s.stack.top >= s.stack.high_water && !grow_stack(worker().current_thread, s.stack.top + 1)) { s.code_stream.current_code = code - codes; goto safe_point; }
+#define CHECK_POP()             if(s.stack.top <= s.stack.frame) { raise_script_error(worker().current_thread, XS_RUNTIME_ERROR_STACK_UNDERFLOW); s.code_stream.current_code = code - codes; goto safe_point; }
+
+#define ARITHMETIC_HANDLER(label, op)                               \
+    label:                                                          \
+    {                                                               \
+        xvm_value* dest = threaded_operand_ptr(s, OPERAND(0));      \
+        xvm_value source = threaded_operand_value(s, OPERAND(1));   \
+        if(dest->type == OP_TYPE_INT)                               \
+        {                                                           \
+            dest->int_literal op cast_value_to_int(source);         \
+        }                                                           \
+        else                                                        \
+        {                                                           \
+            dest->float_literal op cast_value_to_float(source);     \
+        }                                                           \
+        NEXT();                                                     \
+    }
+
+#define INTEGER_HANDLER(label, op)                                  \
+    label:                                                          \
+    {                                                               \
+        xvm_value* dest = threaded_operand_ptr(s, OPERAND(0));      \
+        xvm_value source = threaded_operand_value(s, OPERAND(1));   \
+        if(dest->type == OP_TYPE_INT)                               \
+        {                                                           \
+            dest->int_literal op cast_value_to_int(source);         \
+        }                                                           \
+        NEXT();                                                     \
+    }
+
+#define JUMP_HANDLER(label, opcode, op)                             \
+    label:                                                          \
+    {                                                               \
+        xvm_value v0 = threaded_operand_value(s, OPERAND(0));       \
+        xvm_value v1 = threaded_operand_value(s, OPERAND(1));       \
+        bool is_jump;                                               \
+        if(v0.type == OP_TYPE_INT)                                  \
+        {                                                           \
+            is_jump = v0.int_literal op v1.int_literal;             \
+        }                                                           \
+        else                                                        \
+        {                                                           \
+            is_jump = is_jump_taken(s, opcode, v0, v1);             \
+        }                                                           \
+        if(is_jump)                                                 \
+        {                                                           \
+            BRANCH(OPERAND(2).instruction_index);                   \
+        }                                                           \
+        NEXT();                                                     \
+    }
+
+    //quickened handlers take the fast path when the values are integers and otherwise
+    //fall back to the generic handler for the same opcode
+#define QUICK_ARITHMETIC_HANDLERS(name, op, generic)                \
+    q_##name##_stack_stack:                                         \
+    {                                                               \
+        xvm_value* dest = STACK_OPERAND(0);                         \
+        xvm_value* source = STACK_OPERAND(1);                       \
+        if(dest->type == OP_TYPE_INT && source->type == OP_TYPE_INT)\
+        {                                                           \
+            dest->int_literal op source->int_literal;               \
+            NEXT();                                                 \
+        }                                                           \
+        goto generic;                                               \
+    }                                                               \
+    q_##name##_stack_int:                                           \
+    {                                                               \
+        xvm_value* dest = STACK_OPERAND(0);                         \
+        if(dest->type == OP_TYPE_INT)                               \
+        {                                                           \
+            dest->int_literal op OPERAND(1).int_literal;            \
+            NEXT();                                                 \
+        }                                                           \
+        goto generic;                                               \
+    }
+
+#define QUICK_JUMP_HANDLERS(name, op, generic)                      \
+    q_##name##_stack_stack:                                         \
+    {                                                               \
+        xvm_value* v0 = STACK_OPERAND(0);                           \
+        if(v0->type == OP_TYPE_INT)                                 \
+        {                                                           \
+            if(v0->int_literal op STACK_OPERAND(1)->int_literal)    \
+            {                                                       \
+                BRANCH(OPERAND(2).instruction_index);               \
+            }                                                       \
+            NEXT();                                                 \
+        }                                                           \
+        goto generic;                                               \
+    }                                                               \
+    q_##name##_stack_int:                                           \
+    {                                                               \
+        xvm_value* v0 = STACK_OPERAND(0);                           \
+        if(v0->type == OP_TYPE_INT)                                 \
+        {                                                           \
+            if(v0->int_literal op OPERAND(1).int_literal)           \
+            {                                                       \
+                BRANCH(OPERAND(2).instruction_index);               \
+            }                                                       \
+            NEXT();                                                 \
+        }                                                           \
+        goto generic;                                               \
+    }
+
+        DISPATCH();
+
+    q_mov_stack_stack:
+        *STACK_OPERAND(0) = *STACK_OPERAND(1);
+        NEXT();
+
+    q_mov_stack_literal:
+        *STACK_OPERAND(0) = OPERAND(1);
+        NEXT();
+
+    q_mov_stack_reg:
+        *STACK_OPERAND(0) = s._RetVal;
+        NEXT();
+
+    q_mov_reg_stack:
+        s._RetVal = *STACK_OPERAND(1);
+        NEXT();
+
+    QUICK_ARITHMETIC_HANDLERS(add, +=, op_add)
+    QUICK_ARITHMETIC_HANDLERS(sub, -=, op_sub)
+    QUICK_ARITHMETIC_HANDLERS(mul, *=, op_mul)
+
+    q_inc_stack:
+    {
+        xvm_value* dest = STACK_OPERAND(0);
+        if(dest->type == OP_TYPE_INT)
+        {
+            ++dest->int_literal;
+            NEXT();
+        }
+        goto op_inc;
+    }
+
+    q_dec_stack:
+    {
+        xvm_value* dest = STACK_OPERAND(0);
+        if(dest->type == OP_TYPE_INT)
+        {
+            --dest->int_literal;
+            NEXT();
+        }
+        goto op_dec;
+    }
+
+    QUICK_JUMP_HANDLERS(je, ==, op_je)
+    QUICK_JUMP_HANDLERS(jne, !=, op_jne)
+    QUICK_JUMP_HANDLERS(jg, >, op_jg)
+    QUICK_JUMP_HANDLERS(jl, <, op_jl)
+    QUICK_JUMP_HANDLERS(jge, >=, op_jge)
+    QUICK_JUMP_HANDLERS(jle, <=, op_jle)
+
+    q_push_stack:
+        RESERVE_PUSH();
+    q_push_stack_unchecked:
+        s.stack.elements[s.stack.top] = *STACK_OPERAND(0);
+        ++s.stack.top;
+        NEXT();
+
+    q_push_literal:
+        RESERVE_PUSH();
+    q_push_literal_unchecked:
+        s.stack.elements[s.stack.top] = OPERAND(0);
+        ++s.stack.top;
+        NEXT();
+
+    q_push_reg:
+        RESERVE_PUSH();
+    q_push_reg_unchecked:
+        s.stack.elements[s.stack.top] = s._RetVal;
+        ++s.stack.top;
+        NEXT();
+
+    q_pop_stack:
+        CHECK_POP();
+    q_pop_stack_unchecked:
+        --s.stack.top;
+        *STACK_OPERAND(0) = s.stack.elements[s.stack.top];
+        NEXT();
+
+    q_pop_reg:
+        CHECK_POP();
+    q_pop_reg_unchecked:
+        --s.stack.top;
+        s._RetVal = s.stack.elements[s.stack.top];
+        NEXT();
+
+    op_mov:
+    {
+        xvm_value source = threaded_operand_value(s, OPERAND(1));
+        *threaded_operand_ptr(s, OPERAND(0)) = source;
+        NEXT();
+    }
+
+    ARITHMETIC_HANDLER(op_add, +=)
+    ARITHMETIC_HANDLER(op_sub, -=)
+    ARITHMETIC_HANDLER(op_mul, *=)
+    ARITHMETIC_HANDLER(op_div, /=)
+    INTEGER_HANDLER(op_mod, %=)
+
+    op_exp:
+    {
+        xvm_value* dest = threaded_operand_ptr(s, OPERAND(0));
+        xvm_value source = threaded_operand_value(s, OPERAND(1));
+        if(dest->type == OP_TYPE_INT)
+        {
+            dest->int_literal = static_cast<int>(pow(dest->int_literal, cast_value_to_int(source)));
+        }
+        else
+        {
+            dest->float_literal = static_cast<float>(pow(dest->float_literal, cast_value_to_float(source)));
+        }
+        NEXT();
+    }
+
+    op_neg:
+    {
+        xvm_value* dest = threaded_operand_ptr(s, OPERAND(0));
+        if(dest->type == OP_TYPE_INT)
+        {
+            dest->int_literal = -dest->int_literal;
+        }
+        else
+        {
+            dest->float_literal = -dest->float_literal;
+        }
+        NEXT();
+    }
+
+    op_inc:
+    {
+        xvm_value* dest = threaded_operand_ptr(s, OPERAND(0));
+        if(dest->type == OP_TYPE_INT)
+        {
+            ++dest->int_literal;
+        }
+        else
+        {
+            ++dest->float_literal;
+        }
+        NEXT();
+    }
+
+    op_dec:
+    {
+        xvm_value* dest = threaded_operand_ptr(s, OPERAND(0));
+        if(dest->type == OP_TYPE_INT)
+        {
+            --dest->int_literal;
+        }
+        else
+        {
+            --dest->float_literal;
+        }
+        NEXT();
+    }
+
+    INTEGER_HANDLER(op_and, &=)
+    INTEGER_HANDLER(op_or, |=)
+    INTEGER_HANDLER(op_xor, ^=)
+    INTEGER_HANDLER(op_shl, <<=)
+    INTEGER_HANDLER(op_shr, >>=)
+
+    op_not:
+    {
+        xvm_value* dest = threaded_operand_ptr(s, OPERAND(0));
+        if(dest->type == OP_TYPE_INT)
+        {
+            dest->int_literal = ~dest->int_literal;
+        }
+        NEXT();
+    }
+
+    op_concat:
+    {
+        xvm_value* dest = threaded_operand_ptr(s, OPERAND(0));
+        string source_string = cast_value_to_string(threaded_operand_value(s, OPERAND(1)));
+        concat_string(worker().current_thread, *dest, source_string);
+        NEXT();
+    }
+
+    op_getchar:
+    {
+        int source_index = cast_value_to_int(threaded_operand_value(s, OPERAND(2)));
+
+        char ch[2];
+        ch[0] = get_string_char(worker().current_thread, threaded_operand_value(s, OPERAND(1)), source_index);
+        ch[1] = '\0';
+
+        xvm_value* dest = threaded_operand_ptr(s, OPERAND(0));
+        dest->type = OP_TYPE_STRING_INDEX;
+        dest->string_index = add_string_if_new(worker().current_thread, ch);
+        NEXT();
+    }
+
+    op_setchar:
+    {
+        xvm_value* dest = threaded_operand_ptr(s, OPERAND(0));
+        flatten_string(worker().current_thread, *dest);
+        if(dest->type == OP_TYPE_STRING_INDEX)
+        {
+            int dest_index = cast_value_to_int(threaded_operand_value(s, OPERAND(1)));
+            string source_string = cast_value_to_string(threaded_operand_value(s, OPERAND(2)));
+
+            //strings are interned and shared, so write to a copy
+            string new_string = get_script_string(s, dest->string_index);
+            if(dest_index >= 0 && dest_index < new_string.size())
+            {
+                new_string[dest_index] = source_string[0];
+                dest->string_index = add_string_if_new(worker().current_thread, new_string);
+            }
+        }
+        NEXT();
+    }
+
+    op_jmp:
+        BRANCH(OPERAND(0).instruction_index);
+
+    JUMP_HANDLER(op_je, INSTR_JE, ==)
+    JUMP_HANDLER(op_jne, INSTR_JNE, !=)
+    JUMP_HANDLER(op_jg, INSTR_JG, >)
+    JUMP_HANDLER(op_jl, INSTR_JL, <)
+    JUMP_HANDLER(op_jge, INSTR_JGE, >=)
+    JUMP_HANDLER(op_jle, INSTR_JLE, <=)
+
+    op_push:
+        RESERVE_PUSH();
+    op_push_unchecked:
+    {
+        xvm_value v = threaded_operand_value(s, OPERAND(0));
+        s.stack.elements[s.stack.top] = v;
+        ++s.stack.top;
+        NEXT();
+    }
+
+    op_pop:
+        CHECK_POP();
+    op_pop_unchecked:
+    {
+        --s.stack.top;
+        xvm_value v = s.stack.elements[s.stack.top];
+        *threaded_operand_ptr(s, OPERAND(0)) = v;
+        NEXT();
+    }
+
+    //superinstructions, the rest of the fused sequence follows the head and supplies the operands
+#define LOAD_PAIR()\
+        xvm_value v0 = threaded_operand_value(s, OPERAND(0));\
+        xvm_value v1 = threaded_operand_value(s, code[1].oplist[0]);\
+        *threaded_operand_ptr(s, code[2].oplist[0]) = v1;\
+        *threaded_operand_ptr(s, code[3].oplist[0]) = v0;
+
+    op_push_pop:
+    {
+        xvm_value v = threaded_operand_value(s, OPERAND(0));
+        *threaded_operand_ptr(s, code[1].oplist[0]) = v;
+        code += 2;
+        DISPATCH();
+    }
+
+    op_push_pair:
+    {
+        LOAD_PAIR();
+        code += 4;
+        DISPATCH();
+    }
+
+    op_cmp_push:
+        RESERVE_PUSH();
+    op_cmp_push_unchecked:
+    {
+        LOAD_PAIR();
+        xvm_value& result = s.stack.elements[s.stack.top];
+        result.type = OP_TYPE_INT;
+        result.int_literal = is_jump_taken(s, code[4].opcode, v0, v1);
+        ++s.stack.top;
+        code += 8;
+        DISPATCH();
+    }
+
+    op_cmp_branch:
+    {
+        LOAD_PAIR();
+        xvm_value* result = threaded_operand_ptr(s, code[8].oplist[0]);
+        result->type = OP_TYPE_INT;
+        result->int_literal = is_jump_taken(s, code[4].opcode, v0, v1);
+        if(!result->int_literal)
+        {
+            BRANCH(code[9].oplist[2].instruction_index);
+        }
+        code += 10;
+        DISPATCH();
+    }
+
+    op_call:
+    {
+        //calls are checked like back edges so recursion can't starve the other threads
+        int function_index = OPERAND(0).function_index;
+        if(jit_mode != XS_JIT_OFF && count_jit_event(s.image->function_table[function_index].call_count, JIT_HOT_CALL_COUNT))
+        {
+            jit_compile_function(*s.image, function_index);
+        }
+
+        s.code_stream.current_code = code - codes + 1;
+        if(!call_function(worker().current_thread, function_index))
+        {
+            goto safe_point;
+        }
+        branch_target = s.code_stream.current_code;
+        goto back_edge;
+    }
+
+    op_ret:
+    {
+        //_Main can't return, so every function returning was called
+        const call_frame& frame = s.call_stack.back();
+        int return_address = frame.return_code;
+        bool is_stack_base = frame.is_stack_base;
+
+        //pop the frame record and the stack frame below it
+        s.stack.top = s.stack.frame - 1 - frame.callee->stack_frame_size;
+        s.stack.frame = frame.saved_frame;
+        s.call_stack.pop_back();
+
+        //a stack base marker means control returns to the host
+        if(is_stack_base)
+        {
+            is_exit_execute_loop = true;
+            s.code_stream.current_code = return_address;
+            goto safe_point;
+        }
+
+        code = codes + return_address;
+        DISPATCH();
+    }
+
+    op_callhost:
+    {
+        int cc = code - codes;
+        s.code_stream.current_code = cc;
+
+        //the stack depths count on the call taking off the parameters the compiler says it passed
+        int param_count = code->opcount > 1 ? OPERAND(1).int_literal : -1;
+        int top = s.stack.top;
+        int frame = s.stack.frame;
+        if(top - param_count < frame)
+        {
+            raise_script_error(worker().current_thread, XS_RUNTIME_ERROR_STACK_UNDERFLOW);
+            goto safe_point;
+        }
+
+        const host_api_binding& host_api = s.host_api_bindings[OPERAND(0).host_api_index];
+        if(host_api.function != NULL)
+        {
+            host_api.function(this, worker().current_thread, host_api.user_data);
+        }
+
+        if(cc == s.code_stream.current_code)
+        {
+            ++s.code_stream.current_code;
+            if(param_count >= 0 && frame == s.stack.frame)
+            {
+                s.stack.top = top - param_count;
+            }
+        }
+
+        //the host may have stopped, paused or unloaded the script
+        if(!s.is_active || !s.is_running || s.is_paused)
+        {
+            goto safe_point;
+        }
+
+        code = codes + s.code_stream.current_code;
+        DISPATCH();
+    }
+
+    op_pause:
+    {
+        s.pause_end_time = get_current_time() + cast_value_to_int(threaded_operand_value(s, OPERAND(0)));
+        s.is_paused = true;
+        update_schedule(worker().current_thread);
+        s.code_stream.current_code = code - codes + 1;
+        goto safe_point;
+    }
+
+    op_exit:
+    {
+        s.is_running = false;
+        update_schedule(worker().current_thread);
+        s.code_stream.current_code = code - codes + 1;
+        goto safe_point;
+    }
+
+    op_nop:
+        NEXT();
+
+    op_jit_enter:
+    {
+        //the instruction is a JIT compiled function's entry point or loop header
+        int code_index = code - codes;
+        int back_edge_count = 0;
+        branch_target = jit_execute(code->function_index, code_index, back_edge_count);
+        if(branch_target == code_index)
+        {
+            //native code bailed out on the first instruction, so interpret it
+            goto *get_code_handler(*code, s.image->is_stack_proven);
+        }
+
+        //straight-line runs don't need another clock check. native loop iterations cost
+        //one instruction of fuel each, back_edge charges the last one
+        if(back_edge_count > 0)
+        {
+            if(timeslice_mode == XS_TIMESLICE_FUEL)
+            {
+                charge_fuel(back_edge_count - 1, run_fuel);
+            }
+            goto back_edge;
+        }
+        code = codes + branch_target;
+        DISPATCH();
+    }
+
+    back_edge:
+        //an operand out of the stack stops the script where it happened, loops and calls notice it here
+        if(!s.is_running)
+        {
+            s.code_stream.current_code = branch_target;
+            goto safe_point;
+        }
+
+        //count loop iterations towards compiling the enclosing function
+        if(jit_mode != XS_JIT_OFF)
+        {
+            int function_index = codes[branch_target].function_index;
+            if(function_index >= 0 && count_jit_event(s.image->function_table[function_index].back_edge_count, JIT_HOT_BACK_EDGE_COUNT))
+            {
+                jit_compile_function(*s.image, function_index);
+            }
+        }
+
+        //leave the burst once either the thread's or the caller's timeslice has run out
+        if(timeslice_mode == XS_TIMESLICE_FUEL)
+        {
+            //charge the straight-line run the branch closes, calls jump forward and cost one
+            int run_length = code - codes - branch_target + 1;
+            charge_fuel(run_length > 0 ? run_length : 1, run_fuel);
+            if((worker().current_thread_mode != THREAD_MODE_SINGLE && worker().thread_fuel <= 0) || run_fuel == 0)
+            {
+                s.code_stream.current_code = branch_target;
+                goto safe_point;
+            }
+        }
+        else
+        {
+            current_time = get_current_time();
+            if((worker().current_thread_mode != THREAD_MODE_SINGLE &&
+                current_time > worker().current_thread_active_time + s.timeslice_duration) ||
+               (timeslice_duration != XS_INFINITE_TIMESLICE &&
+                current_time > main_timeslice_start_time + timeslice_duration))
+            {
+                s.code_stream.current_code = branch_target;
+                goto safe_point;
+            }
+        }
+        code = codes + branch_target;
+        DISPATCH();
+
+#undef DISPATCH
+#undef NEXT
+#undef OPERAND
+#undef BRANCH
+#undef STACK_OPERAND
+#undef RESERVE_PUSH
+#undef CHECK_POP
+#undef QUICK_ARITHMETIC_HANDLERS
+#undef QUICK_JUMP_HANDLERS
+#undef ARITHMETIC_HANDLER
+#undef INTEGER_HANDLER
+#undef JUMP_HANDLER
+#undef LOAD_PAIR
+
+    safe_point:
+        if(timeslice_mode == XS_TIMESLICE_FUEL)
+        {
+            if(run_fuel == 0)
+            {
+                break;
+            }
+        }
+        else if(timeslice_duration != XS_INFINITE_TIMESLICE)
+        {
+            if(current_time > main_timeslice_start_time + timeslice_duration)
+            {
+                break;
+            }
+        }
+
+        if(is_exit_execute_loop)
+        {
+            break;
+        }
+    }
+#endif
+}
+
+//operand kinds the quickening pass specializes on
+enum QUICK_OPERAND_KIND
+{
+    QUICK_OPERAND_OTHER = 0,//relative stack index, jump target, function index...
+    QUICK_OPERAND_STACK,
+    QUICK_OPERAND_REG,
+    QUICK_OPERAND_INT,
+    QUICK_OPERAND_LITERAL,//float or string literal
+};
+
+static int get_quick_operand_kind(const xvm_operand& op)
+{
+    switch(op.type)
+    {
+    case OP_TYPE_ABS_STACK_INDEX:
+        return QUICK_OPERAND_STACK;
+    case OP_TYPE_REG:
+        return QUICK_OPERAND_REG;
+    case OP_TYPE_INT:
+        return QUICK_OPERAND_INT;
+    case OP_TYPE_FLOAT:
+    case OP_TYPE_STRING_INDEX:
+        return QUICK_OPERAND_LITERAL;
+    default:
+        return QUICK_OPERAND_OTHER;
+    }
+}
+
+void xvm::quicken_code_stream(program_image& image, int first_code, int last_code)
+{
+    xvm_code_vector& codes = image.codes;
+    for(int i = first_code; i < last_code; ++i)
+    {
+        xvm_code& code = codes[i];
+        code.quick_opcode = QINSTR_NONE;
+
+        int k0 = code.opcount > 0 ? get_quick_operand_kind(code.oplist[0]) : QUICK_OPERAND_OTHER;
+        int k1 = code.opcount > 1 ? get_quick_operand_kind(code.oplist[1]) : QUICK_OPERAND_OTHER;
+
+        switch(code.opcode)
+        {
+        case INSTR_MOV:
+            if(k0 == QUICK_OPERAND_STACK)
+            {
+                switch(k1)
+                {
+                case QUICK_OPERAND_STACK:   code.quick_opcode = QINSTR_MOV_STACK_STACK; break;
+                case QUICK_OPERAND_INT:
+                case QUICK_OPERAND_LITERAL: code.quick_opcode = QINSTR_MOV_STACK_LITERAL; break;
+                case QUICK_OPERAND_REG:     code.quick_opcode = QINSTR_MOV_STACK_REG; break;
+                }
+            }
+            else if(k0 == QUICK_OPERAND_REG && k1 == QUICK_OPERAND_STACK)
+            {
+                code.quick_opcode = QINSTR_MOV_REG_STACK;
+            }
+            break;
+        case INSTR_ADD:
+        case INSTR_SUB:
+        case INSTR_MUL:
+        {
+            //the variants are laid out in ADD, SUB, MUL pairs of (stack, stack), (stack, int)
+            int base = QINSTR_ADD_STACK_STACK + (code.opcode - INSTR_ADD) * 2;
+            if(k0 == QUICK_OPERAND_STACK && k1 == QUICK_OPERAND_STACK)
+            {
+                code.quick_opcode = base;
+            }
+            else if(k0 == QUICK_OPERAND_STACK && k1 == QUICK_OPERAND_INT)
+            {
+                code.quick_opcode = base + 1;
+            }
+            break;
+        }
+        case INSTR_INC:
+        case INSTR_DEC:
+            if(k0 == QUICK_OPERAND_STACK)
+            {
+                code.quick_opcode = code.opcode == INSTR_INC ? QINSTR_INC_STACK : QINSTR_DEC_STACK;
+            }
+            break;
+        case INSTR_JE:
+        case INSTR_JNE:
+        case INSTR_JG:
+        case INSTR_JL:
+        case INSTR_JGE:
+        case INSTR_JLE:
+        {
+            //the variants follow the opcode order in (stack, stack), (stack, int) pairs
+            int base = QINSTR_JE_STACK_STACK + (code.opcode - INSTR_JE) * 2;
+            if(k0 == QUICK_OPERAND_STACK && k1 == QUICK_OPERAND_STACK)
+            {
+                code.quick_opcode = base;
+            }
+            else if(k0 == QUICK_OPERAND_STACK && k1 == QUICK_OPERAND_INT)
+            {
+                code.quick_opcode = base + 1;
+            }
+            break;
+        }
+        case INSTR_PUSH:
+            switch(k0)
+            {
+            case QUICK_OPERAND_STACK:   code.quick_opcode = QINSTR_PUSH_STACK; break;
+            case QUICK_OPERAND_INT:
+            case QUICK_OPERAND_LITERAL: code.quick_opcode = QINSTR_PUSH_LITERAL; break;
+            case QUICK_OPERAND_REG:     code.quick_opcode = QINSTR_PUSH_REG; break;
+            }
+            break;
+        case INSTR_POP:
+            switch(k0)
+            {
+            case QUICK_OPERAND_STACK:   code.quick_opcode = QINSTR_POP_STACK; break;
+            case QUICK_OPERAND_REG:     code.quick_opcode = QINSTR_POP_REG; break;
+            }
+            break;
+        }
+    }
+}
+
+static bool is_same_stack_operand(const xvm_operand& op0, const xvm_operand& op1)
+{
+    return op0.type == OP_TYPE_ABS_STACK_INDEX && op1.type == OP_TYPE_ABS_STACK_INDEX && op0.stack_index == op1.stack_index;
+}
+
+static bool is_int_literal(const xvm_operand& op, int value)
+{
+    return op.type == OP_TYPE_INT && op.int_literal == value;
+}
+
+static bool is_jump_to(const xvm_operand& op, int target)
+{
+    return op.type == OP_TYPE_INSTR_INDEX && op.instruction_index == target;
+}
+
+//returns the superinstruction the sequence starting at index can be fused into and its length,
+//or 0 if nothing matches. jump_counts holds how many ways there are into each instruction other
+//than falling through, the inside of a sequence may only be reached from the sequence itself
+static int match_superinstruction(const xvm_code_vector& codes, const std::vector<int>& jump_counts, int first_code, int last_code, int index, int& opcode)
+{
+    const xvm_code* c = &codes[index];
+    const int* jumps = &jump_counts[index - first_code];
+    int count = last_code - index;
+
+    if(count < 2 || c[0].opcode != INSTR_PUSH || jumps[1] != 0)
+    {
+        return 0;
+    }
+
+    //Push X; Pop Y
+    if(c[1].opcode == INSTR_POP)
+    {
+        opcode = INSTR_PUSH_POP;
+        return 2;
+    }
+
+    //Push A; Push B; Pop _T1; Pop _T0, the operand load of every binary expression
+    if(count < 4 || c[1].opcode != INSTR_PUSH || c[2].opcode != INSTR_POP || c[3].opcode != INSTR_POP ||
+       jumps[2] != 0 || jumps[3] != 0)
+    {
+        return 0;
+    }
+
+    //followed by a relational expression that pushes 0 or 1
+    const xvm_operand& t1 = c[2].oplist[0];
+    const xvm_operand& t0 = c[3].oplist[0];
+    bool is_relational = count >= 8 &&
+        t0.type == OP_TYPE_ABS_STACK_INDEX && t1.type == OP_TYPE_ABS_STACK_INDEX && t0.stack_index != t1.stack_index &&
+        c[4].opcode >= INSTR_JE && c[4].opcode <= INSTR_JLE &&
+        is_same_stack_operand(c[4].oplist[0], t0) && is_same_stack_operand(c[4].oplist[1], t1) && is_jump_to(c[4].oplist[2], index + 7) &&
+        c[5].opcode == INSTR_PUSH && is_int_literal(c[5].oplist[0], 0) &&
+        c[6].opcode == INSTR_JMP && is_jump_to(c[6].oplist[0], index + 8) &&
+        c[7].opcode == INSTR_PUSH && is_int_literal(c[7].oplist[0], 1) &&
+        jumps[4] == 0 && jumps[5] == 0 && jumps[6] == 0 && jumps[7] == 1;
+    if(!is_relational)
+    {
+        opcode = INSTR_PUSH_PAIR;
+        return 4;
+    }
+
+    //and then by the test an if or while makes on the pushed result
+    if(count >= 10 && c[8].opcode == INSTR_POP && c[9].opcode == INSTR_JE &&
+       is_same_stack_operand(c[9].oplist[0], c[8].oplist[0]) && is_int_literal(c[9].oplist[1], 0) &&
+       c[9].oplist[2].type == OP_TYPE_INSTR_INDEX && jumps[8] == 1 && jumps[9] == 0)
+    {
+        opcode = INSTR_CMP_BRANCH;
+        return 10;
+    }
+
+    opcode = INSTR_CMP_PUSH;
+    return 8;
+}
+
+void xvm::fuse_code_stream(program_image& image, int first_code, int last_code)
+{
+    xvm_code_vector& codes = image.codes;
+    function_vector& functions = image.function_table;
+
+    //count the jumps and calls into each instruction, jumps never leave a function so the range is enough
+    std::vector<int> jump_counts(last_code - first_code, 0);
+    for(int i = first_code; i < last_code; ++i)
+    {
+        const xvm_operand* target = NULL;
+        if(codes[i].opcode == INSTR_JMP)
+        {
+            target = &codes[i].oplist[0];
+        }
+        else if(codes[i].opcode >= INSTR_JE && codes[i].opcode <= INSTR_JLE)
+        {
+            target = &codes[i].oplist[2];
+        }
+
+        if(target && target->type == OP_TYPE_INSTR_INDEX && target->instruction_index >= first_code && target->instruction_index < last_code)
+        {
+            ++jump_counts[target->instruction_index - first_code];
+        }
+    }
+    for(int i = 0; i < functions.size(); ++i)
+    {
+        if(functions[i].entry_point >= first_code && functions[i].entry_point < last_code)
+        {
+            ++jump_counts[functions[i].entry_point - first_code];
+        }
+    }
+
+    //rewrite the head of each matching sequence, the quickened form of the head is kept for the JIT
+    for(int i = first_code; i < last_code;)
+    {
+        int opcode;
+        int length = match_superinstruction(codes, jump_counts, first_code, last_code, i, opcode);
+        if(length == 0)
+        {
+            ++i;
+            continue;
+        }
+
+        codes[i].opcode = opcode;
+        i += length;
+    }
+}
+
+void xvm::thread_code_stream(program_image& image, int first_code, int last_code)
+{
+    if(!threaded_dispatch_table)
+    {
+        return;
+    }
+
+    //resolve every opcode to its handler address once, so dispatch is a single indirect jump
+    xvm_code_vector& codes = image.codes;
+    for(int i = first_code; i < last_code; ++i)
+    {
+        codes[i].handler = get_code_handler(codes[i], image.is_stack_proven);
+    }
+}
+
+void* xvm::get_code_handler(const xvm_code& code, bool is_stack_proven)
+{
+    //the head of a fused sequence keeps its quickened form for the JIT, but runs as the superinstruction
+    if(code.quick_opcode != QINSTR_NONE && code.opcode < INSTR_SUPER_FIRST)
+    {
+        if(is_stack_proven && code.quick_opcode >= QINSTR_PUSH_STACK && code.quick_opcode <= QINSTR_POP_REG)
+        {
+            return threaded_dispatch_table[XVM_UNCHECKED_HANDLER_BASE + 3 + code.quick_opcode - QINSTR_PUSH_STACK];
+        }
+        return threaded_dispatch_table[XVM_QUICK_HANDLER_BASE + code.quick_opcode];
+    }
+
+    int opcode = code.opcode;
+    if(is_stack_proven)
+    {
+        switch(opcode)
+        {
+        case INSTR_PUSH:        return threaded_dispatch_table[XVM_UNCHECKED_HANDLER_BASE];
+        case INSTR_CMP_PUSH:    return threaded_dispatch_table[XVM_UNCHECKED_HANDLER_BASE + 1];
+        case INSTR_POP:         return threaded_dispatch_table[XVM_UNCHECKED_HANDLER_BASE + 2];
+        }
+    }
+    if(opcode < 0 || opcode > INSTR_SUPER_LAST)
+    {
+        opcode = INSTR_SUPER_LAST + 1;
+    }
+
+    return threaded_dispatch_table[opcode];
+}
+
+void xvm::index_functions(program_image& image)
+{
+    xvm_code_vector& codes = image.codes;
+    function_vector& functions = image.function_table;
+
+    //functions are emitted back to back, so each one ends where the next entry point begins
+    for(int i = 0; i < functions.size(); ++i)
+    {
+        function& f = functions[i];
+        f.code_end = codes.size();
+        for(int j = 0; j < functions.size(); ++j)
+        {
+            if(functions[j].entry_point > f.entry_point && functions[j].entry_point < f.code_end)
+            {
+                f.code_end = functions[j].entry_point;
+            }
+        }
+        f.is_decoded = !image.encoded_codes;
+    }
+
+    image.frame_descriptors.resize(functions.size());
+    for(int i = 0; i < functions.size(); ++i)
+    {
+        frame_descriptor& descriptor = image.frame_descriptors[i];
+        descriptor.entry_point = functions[i].entry_point;
+        descriptor.frame_size = functions[i].local_data_size + 2;
+        descriptor.reserve_size = descriptor.frame_size;
+        if(functions[i].operand_depth != XSE2_STACK_DEPTH_UNKNOWN)
+        {
+            descriptor.reserve_size += functions[i].operand_depth;
+        }
+        descriptor.stack_frame_size = functions[i].stack_frame_size;
+        descriptor.function_index = i;
+    }
+
+    //lazily loaded code is indexed as each function is decoded
+    if(image.encoded_codes)
+    {
+        return;
+    }
+
+    for(int i = 0; i < codes.size(); ++i)
+    {
+        codes[i].function_index = -1;
+    }
+    for(int i = 0; i < functions.size(); ++i)
+    {
+        function& f = functions[i];
+        for(int j = f.entry_point; j >= 0 && j < f.code_end; ++j)
+        {
+            codes[j].function_index = i;
+        }
+    }
+}
+
+void xvm::prepare_code(program_image& image, int first_code, int last_code)
+{
+    //pre-decode the instruction stream for the threaded engine
+    quicken_code_stream(image, first_code, last_code);
+    fuse_code_stream(image, first_code, last_code);
+    thread_code_stream(image, first_code, last_code);
+}
+
+bool xvm::decode_function(program_image& image, int function_index)
+{
+    //instances of the image on other workers may call the function at the same time
+    std::lock_guard<std::mutex> lock(image.decode_lock);
+    function& f = image.function_table[function_index];
+    if(f.is_decoded)
+    {
+        return true;
+    }
+
+    //records are fixed-width, so the function's code starts at its entry point in the code section
+    int first_code = f.entry_point < 0 || f.entry_point > f.code_end ? f.code_end : f.entry_point;
+    for(int i = first_code; i < f.code_end; ++i)
+    {
+        decode_instruction(image.encoded_codes[i], image.codes[i]);
+        image.codes[i].function_index = function_index;
+    }
+
+    //the load only checked the tables, the code is verified here before anything runs it. a recorded depth the
+    //function doesn't match would let its pushes skip the stack check, an unknown one only keeps the check
+    std::vector<std::pair<int, int> > calls;
+    int operand_depth = verify_function_code(image, function_index) ? verify_operand_depth(image, function_index, calls) : STACK_DEPTH_INVALID;
+    if(operand_depth == STACK_DEPTH_INVALID || (f.operand_depth != XSE2_STACK_DEPTH_UNKNOWN && operand_depth != f.operand_depth))
+    {
+        return false;
+    }
+    prepare_code(image, first_code, f.code_end);
+
+    __atomic_store_n(&f.is_decoded, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+void xvm::xvm_set_jit_mode(int mode)
+{
+    //native code is only entered from the threaded engine
+    if(!XVM_HAS_JIT || exec_engine != XS_EXEC_ENGINE_THREADED)
+    {
+        mode = XS_JIT_OFF;
+    }
+
+    //drop everything compiled so far, code compiled for one mode isn't valid for another
+    for(int i = 0; i < images.size(); ++i)
+    {
+        function_vector& functions = images[i]->function_table;
+        for(int j = 0; j < functions.size(); ++j)
+        {
+            jit_release_function(*images[i], j);
+            functions[j].call_count = 0;
+            functions[j].back_edge_count = 0;
+            functions[j].is_jit_failed = false;
+        }
+    }
+
+    jit_mode = mode;
+}
+
+int xvm::xvm_get_jit_mismatch_count()
+{
+    return jit_mismatch_count;
+}
+
+bool xvm::count_jit_event(int& counter, int threshold)
+{
+    //instances of the same image may be counting on other workers
+    if(worker_count > 1)
+    {
+        return __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED) == threshold;
+    }
+
+    return ++counter == threshold;
+}
+
+void xvm::jit_compile_function(program_image& image, int function_index)
+{
+    //instances on other workers may be running the image's code, it is only patched between rounds
+    if(is_pool_round_running)
+    {
+        worker().jit_requests.push_back(std::make_pair(&image, function_index));
+        return;
+    }
+
+    function& f = image.function_table[function_index];
+    if(f.native || f.is_jit_failed)
+    {
+        return;
+    }
+    if(!f.is_decoded && !decode_function(image, function_index))
+    {
+        f.is_jit_failed = true;
+        return;
+    }
+
+    xvm_code_vector& codes = image.codes;
+    f.native = jit.compile(&codes[0], f.entry_point, f.code_end, jit_mode == XS_JIT_CROSS_CHECK, image.is_stack_proven);
+    if(!f.native)
+    {
+        f.is_jit_failed = true;
+        return;
+    }
+
+    //route the function's entry point and loop headers into the native code
+    for(int i = 0; i < f.native->entry_points.size(); ++i)
+    {
+        codes[f.native->entry_points[i]].handler = threaded_dispatch_table[XVM_JIT_HANDLER_INDEX];
+    }
+}
+
+void xvm::jit_release_function(program_image& image, int function_index)
+{
+    function& f = image.function_table[function_index];
+    if(!f.native)
+    {
+        return;
+    }
+
+    xvm_code_vector& codes = image.codes;
+    for(int i = 0; i < f.native->entry_points.size(); ++i)
+    {
+        xvm_code& code = codes[f.native->entry_points[i]];
+        code.handler = get_code_handler(code, image.is_stack_proven);
+    }
+
+    jit.release(f.native);
+    f.native = NULL;
+}
+
+void xvm::jit_process_requests()
+{
+    for(int i = 0; i < worker_count; ++i)
+    {
+        std::vector<std::pair<program_image*, int> >& requests = workers[i].jit_requests;
+        for(int j = 0; j < requests.size(); ++j)
+        {
+            program_image& image = *requests[j].first;
+            int function_index = requests[j].second;
+            if(image.function_table[function_index].is_jit_failed)
+            {
+                jit_release_function(image, function_index);
+            }
+            else
+            {
+                jit_compile_function(image, function_index);
+            }
+        }
+        requests.clear();
+    }
+}
+
+int xvm::jit_execute(int function_index, int code_index, int& back_edge_count)
+{
+    script& s = scripts[worker().current_thread];
+    function& f = s.image->function_table[function_index];
+
+    //native code can't grow the stack and bails out of a fused sequence that doesn't have two free slots,
+    //make room now so it doesn't keep doing so near the end of a segment
+    if(s.stack.top + 2 > s.stack.high_water && s.stack.top + 2 <= s.stack.size)
+    {
+        grow_stack(worker().current_thread, s.stack.top + 2);
+    }
+
+    jit_context context;
+    context.elements = &s.stack.elements[0];
+    context.ret_val = &s._RetVal;
+    context.top = s.stack.top;
+    context.frame = s.stack.frame;
+    context.push_limit = s.stack.high_water - 1;
+    context.budget = JIT_BACK_EDGE_BUDGET;
+    context.steps = 0;
+
+    if(jit_mode != XS_JIT_CROSS_CHECK)
+    {
+        int next_code = jit.execute(f.native, &context, code_index);
+        s.stack.top = context.top;
+        back_edge_count = JIT_BACK_EDGE_BUDGET - context.budget;
+        return next_code;
+    }
+
+    //cross-check: run the native code, then replay the same number of instructions in the
+    //reference interpreter from the same starting state. the interpreter's result is kept.
+    //only the live part of the stack is compared, a fused sequence leaves different scratch above the top
+    value_vector start_stack(s.stack.elements);
+    xvm_value start_ret_val = s._RetVal;
+    int start_top = s.stack.top;
+
+    int native_next_code = jit.execute(f.native, &context, code_index);
+    back_edge_count = JIT_BACK_EDGE_BUDGET - context.budget;
+    value_vector native_stack(s.stack.elements);
+    xvm_value native_ret_val = s._RetVal;
+
+    s.stack.elements = start_stack;
+    s._RetVal = start_ret_val;
+    s.stack.top = start_top;
+    s.code_stream.current_code = code_index;
+
+    int is_exit_execute_loop = false;
+    for(int i = 0; i < context.steps; ++i)
+    {
+        execute_instruction(0, is_exit_execute_loop);
+    }
+
+    if(s.code_stream.current_code != native_next_code || s.stack.top != context.top ||
+       memcmp(&s._RetVal, &native_ret_val, sizeof(xvm_value)) != 0 ||
+       memcmp(&s.stack.elements[0], &native_stack[0], sizeof(xvm_value) * context.top) != 0)
+    {
+        ++jit_mismatch_count;
+
+        //stop using the native code for this function
+        if(is_pool_round_running)
+        {
+            __atomic_store_n(&f.is_jit_failed, true, __ATOMIC_RELAXED);
+            worker().jit_requests.push_back(std::make_pair(s.image, function_index));
+        }
+        else
+        {
+            jit_release_function(*s.image, function_index);
+            f.is_jit_failed = true;
+        }
+    }
+
+    return s.code_stream.current_code;
+}
+
+void xvm::xvm_start_script(int script_index)
+{
+    //there's nothing to run without _Main
+    if(!is_thread_active(script_index) || scripts[script_index].runtime_error != XS_RUNTIME_OK ||
+        !scripts[script_index].image->is_main_function_present)
+    {
+        return;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(schedule_mutex);
+    scripts[script_index].is_running = true;
+    update_schedule(script_index);
+
+    //the started script runs first, unless a pool worker is in the middle of another one
+    if(worker().current_thread_mode == THREAD_MODE_WORKER)
+    {
+        return;
+    }
+    if(scripts[script_index].schedule_queue == SCHEDULE_QUEUE_READY)
+    {
+        ready_head = script_index;
+    }
+    worker().current_thread = script_index;
+    worker().current_thread_active_time = get_current_time();
+    worker().thread_fuel = get_thread_fuel(script_index);
+}
+
+void xvm::xvm_stop_script(int script_index)
+{
+    if(!is_thread_active(script_index))
+    {
+        return;
+    }
+
+    scripts[script_index].is_running = false;
+    update_schedule(script_index);
+}
+
+void xvm::xvm_pause_script(int script_index, int duration)
+{
+    if(!is_thread_active(script_index))
+    {
+        return;
+    }
+
+    scripts[script_index].is_paused = true;
+    scripts[script_index].pause_end_time = get_current_time() + duration;
+    update_schedule(script_index);
+}
+
+void xvm::xvm_unpause_script(int script_index)
+{
+    if(!is_thread_active(script_index))
+    {
+        return;
+    }
 
-            switch(opcode)
-            {
-            case INSTR_NEG:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal = -dest.int_literal;
-                }
-                else
-                {
-                    dest.float_literal = -dest.float_literal;
-                }
-                break;
-            case INSTR_NOT:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    dest.int_literal = ~dest.int_literal;
-                }
-            case INSTR_INC:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    ++dest.int_literal;
-                }
-                else
-                {
-                    ++dest.float_literal;
-                }
-                break;
-            case INSTR_DEC:
-                if(dest.type == OP_TYPE_INT)
-                {
-                    --dest.int_literal;
-                }
-                else
-                {
-                    --dest.float_literal;
-                }
-                break;
-            }//switch(opcode)
-            *resolve_operand_ptr(0) = dest;
-            break;
-        }
-        case INSTR_CONCAT:
-        {
-            xvm_value dest = resolve_operand_value(0);
-            string source_string = resolve_operand_as_string(1);
+    scripts[script_index].is_paused = false;
+    update_schedule(script_index);
+}
 
-            if(dest.type != OP_TYPE_STRING_INDEX)
-            {
-                break;
-            }
+void xvm::xvm_set_timeslice_mode(int mode)
+{
+    timeslice_mode = mode;
 
-            const string& old_string = scripts[current_thread].string_table[dest.string_index];
-            string new_string = old_string + source_string;
-            dest.string_index = add_string_if_new(new_string);
+    //the current thread starts over with a full timeslice of either kind. before anything is loaded
+    //there's no current thread, the scheduler fills up the budget of the first one it picks
+    worker().current_thread_active_time = get_current_time();
+    worker().thread_fuel = is_thread_active(worker().current_thread) ? get_thread_fuel(worker().current_thread) : 0;
+}
 
-            *resolve_operand_ptr(0) = dest;
-            break;
-        }
-        case INSTR_GETCHAR:
-        {
-            xvm_value dest = resolve_operand_value(0);
-            string source_string = resolve_operand_as_string(1);
-            int source_index = resolve_operand_as_int(2);
+void xvm::xvm_set_idle_mode(int mode)
+{
+    idle_mode = mode;
+}
 
-            char ch[2];
-            ch[0] = source_string[source_index];
-            ch[1] = '\0';
-            dest.string_index = add_string_if_new(ch);
+void xvm::xvm_set_load_mode(int mode)
+{
+    load_mode = mode;
+}
 
-            *resolve_operand_ptr(0) = dest;
-            break;
-        }
-        case INSTR_SETCHAR:
-        {
-            if(resolve_operand_type(0) != OP_TYPE_STRING_INDEX)
-            {
-                break;
-            }
+int xvm::xvm_get_sleep_time()
+{
+    if(ready_head >= 0)
+    {
+        return 0;
+    }
+    if(sleeping_count == 0)
+    {
+        return -1;
+    }
 
-            int dest_index = resolve_operand_as_int(1);
-            string source_string = resolve_operand_as_string(2);
-            scripts[current_thread].string_table[resolve_operand_ptr(0)->string_index][dest_index] = source_string[0];
-            break;
-        }
-        case INSTR_JMP:
-        {
-            int target_index = resolve_operand_as_instruction_index(0);
-            scripts[current_thread].code_stream.current_code = target_index;
-            break;
-        }
-        case INSTR_JE:
-        case INSTR_JNE:
-        case INSTR_JG:
-        case INSTR_JL:
-        case INSTR_JGE:
-        case INSTR_JLE:
-        {
-            xvm_value v0 = resolve_operand_value(0);
-            xvm_value v1 = resolve_operand_value(1);
-            int target_index = resolve_operand_as_instruction_index(2);
-            bool is_jump = false;
+    int sleep_time = get_next_wake_time() - get_current_time();
+    return sleep_time > 0 ? sleep_time : 0;
+}
 
-            switch(opcode)
-            {
-            case INSTR_JE:
-                switch(v0.type)
-                {
-                case OP_TYPE_INT:
-                    is_jump = v0.int_literal == v1.int_literal ? true : false;
-                    break;
-                case OP_TYPE_FLOAT:
-                    is_jump = v0.float_literal == v1.float_literal ? true : false;
-                    break;
-                case OP_TYPE_STRING_INDEX:
-                {
-                    string& s0 = scripts[current_thread].string_table[v0.string_index];
-                    string& s1 = scripts[current_thread].string_table[v1.string_index];
-                    is_jump = s0 == s1 ? true : false;
-                    break;
-                }
-                }
-                break;
-            case INSTR_JNE:
-                switch(v0.type)
-                {
-                case OP_TYPE_INT:
-                    is_jump = v0.int_literal != v1.int_literal ? true : false;
-                    break;
-                case OP_TYPE_FLOAT:
-                    is_jump = v0.float_literal != v1.float_literal ? true : false;
-                    break;
-                case OP_TYPE_STRING_INDEX:
-                {
-                    string& s0 = scripts[current_thread].string_table[v0.string_index];
-                    string& s1 = scripts[current_thread].string_table[v1.string_index];
-                    is_jump = s0 == s1 ? true : false;
-                    break;
-                }
-                }
-                break;
-            case INSTR_JG:
-                switch(v0.type)
-                {
-                case OP_TYPE_INT:
-                    is_jump = v0.int_literal > v1.int_literal ? true : false;
-                    break;
-                case OP_TYPE_FLOAT:
-                    is_jump = v0.float_literal > v1.float_literal ? true : false;
-                    break;
-                }
-                break;
-            case INSTR_JL:
-                switch(v0.type)
-                {
-                case OP_TYPE_INT:
-                    is_jump = v0.int_literal < v1.int_literal ? true : false;
-                    break;
-                case OP_TYPE_FLOAT:
-                    is_jump = v0.float_literal < v1.float_literal ? true : false;
-                    break;
-                }
-                break;
-            case INSTR_JGE:
-                switch(v0.type)
-                {
-                case OP_TYPE_INT:
-                    is_jump = v0.int_literal >= v1.int_literal ? true : false;
-                    break;
-                case OP_TYPE_FLOAT:
-                    is_jump = v0.float_literal >= v1.float_literal ? true : false;
-                    break;
-                }
-                break;
-            case INSTR_JLE:
-                switch(v0.type)
-                {
-                case OP_TYPE_INT:
-                    is_jump = v0.int_literal <= v1.int_literal ? true : false;
-                    break;
-                case OP_TYPE_FLOAT:
-                    is_jump = v0.float_literal <= v1.float_literal ? true : false;
-                    break;
-                }
-                break;
-            }//opcode
+long long xvm::get_run_fuel(int timeslice_duration)
+{
+    //-1 leaves the caller's timeslice to the clock(or unlimited)
+    if(timeslice_mode != XS_TIMESLICE_FUEL || timeslice_duration == XS_INFINITE_TIMESLICE)
+    {
+        return -1;
+    }
 
-            if(is_jump)
-            {
-                scripts[current_thread].code_stream.current_code = target_index;
-            }
+    long long fuel = static_cast<long long>(timeslice_duration) * FUEL_PER_TIMESLICE_MS;
+    return fuel > 0 ? fuel : 1;
+}
 
-            break;
-        }
-        case INSTR_PUSH:
-        {
-            xvm_value v = resolve_operand_value(0);
-            push(current_thread, v);
-            break;
-        }
-        case INSTR_POP:
+int xvm::get_thread_fuel(int script_index)
+{
+    //a timeslice under a millisecond(the default is 0) still buys a millisecond's worth, without
+    //any fuel the engines would go back to reading the clock on every instruction
+    int timeslice_duration = scripts[script_index].timeslice_duration;
+    if(timeslice_duration < 1)
+    {
+        return FUEL_PER_TIMESLICE_MS;
+    }
+    return timeslice_duration < INT_MAX / FUEL_PER_TIMESLICE_MS ? timeslice_duration * FUEL_PER_TIMESLICE_MS : INT_MAX;
+}
+
+void xvm::charge_fuel(int amount, long long& run_fuel)
+{
+    worker().thread_fuel -= amount;
+    if(run_fuel > 0)
+    {
+        run_fuel = run_fuel > amount ? run_fuel - amount : 0;
+    }
+}
+
+void xvm::update_schedule(int script_index)
+{
+    std::lock_guard<std::recursive_mutex> lock(schedule_mutex);
+    script& s = scripts[script_index];
+
+    int queue = SCHEDULE_QUEUE_NONE;
+    if(s.is_active && s.is_running)
+    {
+        queue = s.is_paused ? SCHEDULE_QUEUE_SLEEPING : SCHEDULE_QUEUE_READY;
+    }
+
+    //a sleeping script is moved even so, its pause may have been extended or shortened
+    if(queue == s.schedule_queue && queue != SCHEDULE_QUEUE_SLEEPING)
+    {
+        return;
+    }
+
+    if(s.schedule_queue == SCHEDULE_QUEUE_READY)
+    {
+        unlink_script(ready_head, script_index);
+    }
+    else if(s.schedule_queue == SCHEDULE_QUEUE_SLEEPING)
+    {
+        unlink_script(timer_slots[s.timer_slot], script_index);
+        --sleeping_count;
+    }
+
+    if(queue == SCHEDULE_QUEUE_READY)
+    {
+        link_script(ready_head, script_index);
+    }
+    else if(queue == SCHEDULE_QUEUE_SLEEPING)
+    {
+        //the wheel has already processed timer_time, anything due by then wakes on the next tick
+        unsigned int expire_time = s.pause_end_time;
+        if(static_cast<int>(expire_time - timer_time) <= 0)
         {
-            *resolve_operand_ptr(0) = pop(current_thread);
-            break;
+            expire_time = timer_time + 1;
         }
-        case INSTR_CALL:
-        {
-            int function_index = resolve_operand_as_function_index(0);
+        add_timer(script_index, expire_time);
+        ++sleeping_count;
+    }
+    s.schedule_queue = queue;
+}
 
-            //advance the instruction pointer so it points to the instruction immediately following the call
-            ++scripts[current_thread].code_stream.current_code;
-            call_function(current_thread, function_index);
-            break;
-        }
-        case INSTR_RET:
-        {
-            scripts[current_thread].stack.top = scripts[current_thread].stack.frame;
-            xvm_value current_function_data = pop(current_thread);
+void xvm::link_script(int& head, int script_index)
+{
+    script& s = scripts[script_index];
+    if(head < 0)
+    {
+        s.schedule_prev = script_index;
+        s.schedule_next = script_index;
+        head = script_index;
+        return;
+    }
 
-            //check for the presence of a stack base marker
-            if(current_function_data.type ==OP_TYPE_STACK_BASE_MARKER)
-            {
-                is_exit_execute_loop = true;
-            }
+    //the tail is the element before the head
+    int tail = scripts[head].schedule_prev;
+    s.schedule_prev = tail;
+    s.schedule_next = head;
+    scripts[tail].schedule_next = script_index;
+    scripts[head].schedule_prev = script_index;
+}
 
-            //get the previous function index
-            assert(current_function_data.function_index != -1);
-            assert(current_function_data.function_index < scripts[current_thread].function_table.size());
-            function f = get_function(current_thread, current_function_data.function_index);
-            int frame = current_function_data.offset_index;
+void xvm::unlink_script(int& head, int script_index)
+{
+    script& s = scripts[script_index];
+    if(s.schedule_next == script_index)
+    {
+        head = -1;
+        return;
+    }
 
-            //read the return address structure from the stack, which is stored one index below the local data
-            xvm_value return_address = get_stack_value(current_thread, scripts[current_thread].stack.top - (f.local_data_size + 1));
+    scripts[s.schedule_prev].schedule_next = s.schedule_next;
+    scripts[s.schedule_next].schedule_prev = s.schedule_prev;
+    if(head == script_index)
+    {
+        head = s.schedule_next;
+    }
+}
 
-            //pop the stack frame along with the return address
-            pop_frame(f.stack_frame_size);
+int xvm::get_timer_slot(unsigned int expire_time)
+{
+    //the lowest level that still reaches the expire time, indexed by that level's digit of it
+    unsigned int delta = expire_time - timer_time;
+    int level = 0;
+    while(level < TIMER_WHEEL_LEVELS - 1 && delta >= 1u << (TIMER_WHEEL_BITS * (level + 1)))
+    {
+        ++level;
+    }
 
-            //restore the previous frame index
-            scripts[current_thread].stack.frame = frame;
+    return level * TIMER_WHEEL_SLOTS + ((expire_time >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+}
 
-            //make the jump to the return address
-            scripts[current_thread].code_stream.current_code = return_address.instruction_index;
-            break;
-        }
-        case INSTR_CALLHOST:
-        {
-            xvm_value host_api_call = resolve_operand_value(0);
-            int host_api_index = host_api_call.host_api_index;
-            string host_api_name = get_host_api(host_api_index);
-            for(int i = 0; i < MAX_HOST_API_SIZE; ++i)
-            {
-                if(host_api_name == host_apis[i].name)
-                {
-                    int thread_index = host_apis[i].thread_index;
-                    if(thread_index == current_thread || thread_index == XS_GLOBAL_FUNC)
-                    {
-                        host_apis[i].function(current_thread);
-                        break;
-                    }
-                }
-            }
-            break;
-        }
-        case INSTR_PAUSE:
-        {
-            int pause_duration = resolve_operand_as_int(0);
-            scripts[current_thread].pause_end_time = current_time + pause_duration;
-            scripts[current_thread].is_paused = true;
-            break;
-        }
-        case INSTR_EXIT:
+void xvm::add_timer(int script_index, unsigned int expire_time)
+{
+    script& s = scripts[script_index];
+    s.timer_slot = get_timer_slot(expire_time);
+    link_script(timer_slots[s.timer_slot], script_index);
+}
+
+void xvm::cascade_timers(int slot)
+{
+    //move a higher level slot down, now that its window has come up
+    int script_index = timer_slots[slot];
+    if(script_index < 0)
+    {
+        return;
+    }
+    timer_slots[slot] = -1;
+
+    int last = scripts[script_index].schedule_prev;
+    while(true)
+    {
+        int next = scripts[script_index].schedule_next;
+        bool is_last = script_index == last;
+
+        add_timer(script_index, scripts[script_index].pause_end_time);
+
+        if(is_last)
         {
-            xvm_value exit_code = resolve_operand_value(0);
-            int ec = exit_code.int_literal;
-            scripts[current_thread].is_running = false;
             break;
         }
-        }//switch(opcode)
+        script_index = next;
+    }
+}
 
-        if(cc == scripts[current_thread].code_stream.current_code)
+void xvm::advance_timers(int current_time)
+{
+    while(static_cast<int>(current_time - timer_time) > 0)
+    {
+        if(sleeping_count == 0)
         {
-            ++scripts[current_thread].code_stream.current_code;
+            timer_time = current_time;
+            return;
         }
 
-        if(timeslice_duration != XS_INFINITE_TIMESLICE)
+        ++timer_time;
+
+        //each time a level wraps around, the next window of the level above is spread over it.
+        //cascade from the top, so timers moving down two levels are spread again below
+        if((timer_time & TIMER_WHEEL_MASK) == 0)
         {
-            if(current_time > main_timeslice_start_time + timeslice_duration)
+            int top_level = 1;
+            while(top_level < TIMER_WHEEL_LEVELS - 1 && ((timer_time >> (TIMER_WHEEL_BITS * top_level)) & TIMER_WHEEL_MASK) == 0)
             {
-                break;
+                ++top_level;
+            }
+            for(int level = top_level; level >= 1; --level)
+            {
+                cascade_timers(level * TIMER_WHEEL_SLOTS + ((timer_time >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK));
             }
         }
 
-        if(is_exit_execute_loop)
+        //everything in the current level 0 slot is due
+        int slot = timer_time & TIMER_WHEEL_MASK;
+        while(timer_slots[slot] >= 0)
         {
-            break;
+            int script_index = timer_slots[slot];
+            scripts[script_index].is_paused = false;
+            update_schedule(script_index);
         }
     }
 }
 
-void xvm::xvm_start_script(int script_index)
+int xvm::get_next_wake_time()
 {
-    if(!is_thread_active(script_index))
+    if(sleeping_count == 0)
     {
-        return;
+        return timer_time + INT_MAX;
     }
 
-    scripts[script_index].is_running = true;
+    //level 0 slots hold exact times, a higher level slot can only tell when its window starts
+    for(int level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+    {
+        int shift = TIMER_WHEEL_BITS * level;
+        for(int i = 1; i <= TIMER_WHEEL_SLOTS; ++i)
+        {
+            unsigned int window = (timer_time >> shift) + i;
+            if(timer_slots[level * TIMER_WHEEL_SLOTS + (window & TIMER_WHEEL_MASK)] >= 0)
+            {
+                return window << shift;
+            }
+        }
+    }
 
-    current_thread = script_index;
-    current_thread_active_time = get_current_time();
+    return timer_time + INT_MAX;
 }
 
-void xvm::xvm_stop_script(int script_index)
+bool xvm::wait_for_wake(int main_timeslice_start_time, int timeslice_duration)
 {
-    if(!is_thread_active(script_index))
+    if(idle_mode == XS_IDLE_RETURN)
     {
-        return;
+        return false;
     }
 
-    scripts[script_index].is_running = false;  
-}
+    int current_time = get_current_time();
+    int wake_time = get_next_wake_time();
 
-void xvm::xvm_pause_script(int script_index, int duration)
-{
-    if(!is_thread_active(script_index))
+    //in single threaded mode the current thread may be paused without being scheduled
+    if(worker().current_thread_mode == THREAD_MODE_SINGLE && scripts[worker().current_thread].is_paused &&
+       scripts[worker().current_thread].pause_end_time - wake_time < 0)
     {
-        return;
+        wake_time = scripts[worker().current_thread].pause_end_time;
     }
 
-    scripts[script_index].is_paused = true;
-    scripts[script_index].pause_end_time = get_current_time() + duration;    
+    //don't sleep past the caller's timeslice
+    if(timeslice_duration != XS_INFINITE_TIMESLICE)
+    {
+        int end_time = main_timeslice_start_time + timeslice_duration;
+        if(current_time > end_time)
+        {
+            return false;
+        }
+        if(end_time + 1 - wake_time < 0)
+        {
+            wake_time = end_time + 1;
+        }
+    }
+
+    if(wake_time - current_time > 0)
+    {
+        sleep_ms(wake_time - current_time);
+    }
+    return true;
 }
 
-void xvm::xvm_unpause_script(int script_index)
+int xvm::schedule_thread(int current_time)
 {
-    if(!is_thread_active(script_index))
+    xvm_worker& w = worker();
+
+    //a pool worker's burst ends with the script's timeslice, the host's thread does the scheduling
+    if(w.current_thread_mode == THREAD_MODE_WORKER)
     {
-        return;
+        script& s = scripts[w.current_thread];
+        bool is_timeslice_over = timeslice_mode == XS_TIMESLICE_FUEL ? w.thread_fuel <= 0 :
+                                 current_time > w.current_thread_active_time + s.timeslice_duration;
+        return s.schedule_queue == SCHEDULE_QUEUE_READY && !is_timeslice_over ? SCHEDULE_RUN : SCHEDULE_DONE;
+    }
+
+    if(ready_head < 0 && sleeping_count == 0)
+    {
+        return SCHEDULE_DONE;
+    }
+
+    if(get_worker_index() == 0 && current_time != timer_time)
+    {
+        advance_timers(current_time);
+    }
+
+    //check for a context switch if the threading mode is set for multithreading
+    if(w.current_thread_mode == THREAD_MODE_MULTI)
+    {
+        script& s = scripts[w.current_thread];
+        bool is_timeslice_over = timeslice_mode == XS_TIMESLICE_FUEL ? w.thread_fuel <= 0 :
+                                 current_time > w.current_thread_active_time + s.timeslice_duration;
+        if(s.schedule_queue != SCHEDULE_QUEUE_READY || is_timeslice_over)
+        {
+            if(ready_head < 0)
+            {
+                return SCHEDULE_IDLE;
+            }
+
+            //a thread that used up its timeslice goes behind the others
+            if(w.current_thread == ready_head && s.schedule_queue == SCHEDULE_QUEUE_READY)
+            {
+                ready_head = s.schedule_next;
+            }
+            w.current_thread = ready_head;
+            w.current_thread_active_time = current_time;
+            w.thread_fuel = get_thread_fuel(w.current_thread);
+        }
+    }
+    else if(w.thread_fuel <= 0)
+    {
+        w.thread_fuel = get_thread_fuel(w.current_thread);
+    }
+
+    //in single threaded mode the current thread has to wake up by itself
+    script& s = scripts[w.current_thread];
+    if(s.is_paused)
+    {
+        if(current_time < s.pause_end_time)
+        {
+            return SCHEDULE_IDLE;
+        }
+        s.is_paused = false;
+        update_schedule(w.current_thread);
     }
 
-    scripts[script_index].is_paused = false;    
+    return SCHEDULE_RUN;
 }
 
 void xvm::xvm_pass_int_param(int script_index, int v)
@@ -946,7 +4072,7 @@ void xvm::xvm_pass_string_param(int script_index, const char* str)
 {
     xvm_value p;
     p.type = OP_TYPE_STRING_INDEX;
-    p.string_index = add_string_if_new(str);
+    p.string_index = add_string_if_new(script_index, str);
 
     push(script_index, p);
 }
@@ -975,10 +4101,16 @@ string xvm::xvm_get_return_as_string(int script_index)
 {
     if(!is_thread_active(script_index))
     {
-        return NULL;
+        return "";
+    }
+
+    const xvm_value& v = scripts[script_index]._RetVal;
+    if(IS_STRING_BUILDER(v.type))
+    {
+        return get_builder_string(script_index, v);
     }
 
-    return get_string(scripts[script_index]._RetVal.string_index); 
+    return get_string(v.string_index); 
 }
 
 void xvm::xvm_call_script_function(int script_index, const char* fname)
@@ -990,14 +4122,14 @@ void xvm::xvm_call_script_function(int script_index, const char* fname)
 
     ///calling the function
     //preserve the current state of the VM
-    int prev_thread = current_thread;
-    int prev_thread_mode = current_thread_mode;
+    int prev_thread = worker().current_thread;
+    int prev_thread_mode = worker().current_thread_mode;
 
     //set the threading mode for single-threaded execution
-    current_thread_mode = THREAD_MODE_SINGLE;
+    worker().current_thread_mode = THREAD_MODE_SINGLE;
 
     //set the active thread to the one specified
-    current_thread = script_index;
+    worker().current_thread = script_index;
 
     //get the function's index based on it's name
     int function_index = get_function_index_by_name(script_index, fname);
@@ -1007,12 +4139,16 @@ void xvm::xvm_call_script_function(int script_index, const char* fname)
     }
 
     //call the function
-    call_function(script_index, function_index);
+    if(!call_function(script_index, function_index))
+    {
+        worker().current_thread = prev_thread;
+        worker().current_thread_mode = prev_thread_mode;
+        return;
+    }
    
     //set the stack base
-    xvm_value stack_base = get_stack_value(current_thread, scripts[current_thread].stack.top - 1);
-    stack_base.type = OP_TYPE_STACK_BASE_MARKER;
-    set_stack_value(current_thread, scripts[current_thread].stack.top - 1, stack_base);
+    scripts[worker().current_thread].stack.elements[scripts[worker().current_thread].stack.top - 1].type = OP_TYPE_STACK_BASE_MARKER;
+    scripts[worker().current_thread].call_stack.back().is_stack_base = true;
 
     //allow the script code to execute uninterrupted until the function returns
     xvm_run_script(XS_INFINITE_TIMESLICE);
@@ -1020,8 +4156,8 @@ void xvm::xvm_call_script_function(int script_index, const char* fname)
     ///handling the function return
 
     //restore the VM state
-    current_thread = prev_thread;
-    current_thread_mode = prev_thread_mode;
+    worker().current_thread = prev_thread;
+    worker().current_thread_mode = prev_thread_mode;
 }
 
 void xvm::xvm_invoke_script_function(int script_index, const char* fname)
@@ -1040,19 +4176,22 @@ void xvm::xvm_invoke_script_function(int script_index, const char* fname)
     call_function(script_index, function_index);
 }
 
-void xvm::xvm_register_host_api(int script_index, const char* fname, host_api_function_ptr fn)
+void xvm::xvm_register_host_api(int script_index, const char* fname, host_api_function_ptr fn, void* user_data)
 {
-    for(int i = 0; i < MAX_HOST_API_SIZE; ++i)
+    host_api_function host_api;
+    host_api.thread_index = script_index;
+    host_api.function = fn;
+    host_api.user_data = user_data;
+    host_api.name = fname;
+    string_to_upper(const_cast<char*>(host_api.name.c_str()));
+    host_apis.push_back(host_api);
+
+    //a global function can satisfy calls from every loaded script
+    for(int i = 0; i < scripts.size(); ++i)
     {
-        if(!host_apis[i].is_active)
+        if(scripts[i].is_active && (script_index == XS_GLOBAL_FUNC || script_index == i))
         {
-            host_apis[i].thread_index = script_index;
-            host_apis[i].function = fn;
-            host_apis[i].name = fname;
-            string_to_upper(const_cast<char*>(host_apis[i].name.c_str()));
-            host_apis[i].is_active = true;
-
-            break;
+            bind_host_apis(i);
         }
     }
 }
@@ -1108,7 +4247,7 @@ void xvm::xvm_return_string_from_host(int script_index, int param_count, char* s
 
     xvm_value return_value;
     return_value.type = OP_TYPE_STRING_INDEX;
-    return_value.string_index = add_string_if_new(str);
+    return_value.string_index = add_string_if_new(script_index, str);
 
     scripts[script_index]._RetVal = return_value;
     //copy_value(&scripts[script_index]._RetVal, return_value);
@@ -1116,6 +4255,11 @@ void xvm::xvm_return_string_from_host(int script_index, int param_count, char* s
 
 int xvm::cast_value_to_int(const xvm_value& v)
 {
+    if(IS_STRING_BUILDER(v.type))
+    {
+        return atoi(get_builder_string(worker().current_thread, v).c_str());
+    }
+
     switch(v.type)
     {
     case OP_TYPE_INT:
@@ -1131,6 +4275,11 @@ int xvm::cast_value_to_int(const xvm_value& v)
 
 float xvm::cast_value_to_float(const xvm_value& v)
 {
+    if(IS_STRING_BUILDER(v.type))
+    {
+        return atof(get_builder_string(worker().current_thread, v).c_str());
+    }
+
     switch(v.type)
     {
     case OP_TYPE_INT:
@@ -1148,6 +4297,11 @@ string xvm::cast_value_to_string(const xvm_value& v)
 {
     char s[MAX_COERCION_STRING_SIZE];
 
+    if(IS_STRING_BUILDER(v.type))
+    {
+        return get_builder_string(worker().current_thread, v);
+    }
+
     switch(v.type)
     {
     case OP_TYPE_INT:
@@ -1163,57 +4317,26 @@ string xvm::cast_value_to_string(const xvm_value& v)
     }   
 }
 
-#define ASSERT_OPERAND_INDEX(index) assert((index) < scripts[current_thread].code_stream.codes[scripts[current_thread].code_stream.current_code].oplist.size())
 int xvm::get_operand_type(int index)
 {
-    ASSERT_OPERAND_INDEX(index);
-
-    int cc = scripts[current_thread].code_stream.current_code;
-    return scripts[current_thread].code_stream.codes[cc].oplist[index].type;
-}
-
-int xvm::resolve_operand_stack_index(int index)
-{
-    ASSERT_OPERAND_INDEX(index);
-
-    int cc = scripts[current_thread].code_stream.current_code;
-    xvm_value& op = scripts[current_thread].code_stream.codes[cc].oplist[index];
-
-    switch(op.type)
-    {
-    case OP_TYPE_ABS_STACK_INDEX:
-        return op.stack_index;
-    case OP_TYPE_REL_STACK_INDEX:
-    {
-        int base_index = op.stack_index;
-        int offset_index = op.offset_index;
-
-        xvm_value v = get_stack_value(current_thread, offset_index);
-
-        return base_index + v.int_literal;
-    }
-    default:
-        return 0;
-    }   
+    script& s = scripts[worker().current_thread];
+    int cc = s.code_stream.current_code;
+    return s.code_stream.codes[cc].oplist[index].type;
 }
 
 xvm_value xvm::resolve_operand_value(int index)
 {
-    ASSERT_OPERAND_INDEX(index);
-
-    int cc = scripts[current_thread].code_stream.current_code;
-    xvm_value& op = scripts[current_thread].code_stream.codes[cc].oplist[index];
+    script& s = scripts[worker().current_thread];
+    int cc = s.code_stream.current_code;
+    xvm_operand& op = s.code_stream.codes[cc].oplist[index];
 
     switch(op.type)
     {
     case OP_TYPE_ABS_STACK_INDEX:
     case OP_TYPE_REL_STACK_INDEX:
-    {
-        int abs_index = resolve_operand_stack_index(index);
-        return get_stack_value(current_thread, abs_index);
-    }
+        return *threaded_operand_ptr(s, op);
     case OP_TYPE_REG:
-        return scripts[current_thread]._RetVal;
+        return s._RetVal;
     default:
         return op;
     }  
@@ -1270,21 +4393,8 @@ string xvm::resolve_operand_as_host_api(int index)
 
 xvm_value* xvm::resolve_operand_ptr(int index)
 {
-    int t = get_operand_type(index);
-
-    switch(t)
-    {
-    case OP_TYPE_ABS_STACK_INDEX:
-    case OP_TYPE_REL_STACK_INDEX: 
-    {  
-        int stack_index = resolve_operand_stack_index(index);
-        return &scripts[current_thread].stack.elements[resolve_stack_index(stack_index)];
-    }
-    case OP_TYPE_REG:
-        return &scripts[current_thread]._RetVal;
-    }
-
-    return NULL;
+    script& s = scripts[worker().current_thread];
+    return threaded_operand_ptr(s, s.code_stream.codes[s.code_stream.current_code].oplist[index]);
 }
 
 xvm_value xvm::get_stack_value(int script_index, int index)
@@ -1300,6 +4410,10 @@ void xvm::set_stack_value(int script_index, int index, const xvm_value& v)
 void xvm::push(int script_index, const xvm_value& v)
 {
     int top = scripts[script_index].stack.top;
+    if(top >= scripts[script_index].stack.high_water && !grow_stack(script_index, top + 1))
+    {
+        return;
+    }
 
     scripts[script_index].stack.elements[top] = v;
     //copy_value(&scripts[script_index].stack.elements[top], v);
@@ -1326,7 +4440,44 @@ void xvm::push_frame(int script_index, int size)
 
 void xvm::pop_frame(int size)
 {
-    scripts[current_thread].stack.top -= size;
+    scripts[worker().current_thread].stack.top -= size;
+}
+
+//raises the high water mark to cover slot_count slots. the memory behind the stack at least doubles
+//when it runs out, so a deepening recursion only moves it a few times.
+//returns false and stops the script if the executable's stack size doesn't allow that many
+bool xvm::grow_stack(int script_index, int slot_count)
+{
+    runtime_stack& stack = scripts[script_index].stack;
+    if(slot_count > stack.size)
+    {
+        raise_script_error(script_index, XS_RUNTIME_ERROR_STACK_OVERFLOW);
+        return false;
+    }
+
+    int high_water = (slot_count + STACK_SEGMENT_SIZE - 1) / STACK_SEGMENT_SIZE * STACK_SEGMENT_SIZE;
+    if(high_water > stack.size)
+    {
+        high_water = stack.size;
+    }
+
+    int allocated = stack.elements.size();
+    if(high_water > allocated)
+    {
+        allocated = allocated * 2 > high_water ? allocated * 2 : high_water;
+        if(allocated > stack.size)
+        {
+            allocated = stack.size;
+        }
+
+        xvm_value null_value;
+        null_value.type = OP_TYPE_NULL;
+        null_value.int_literal = 0;
+        stack.elements.resize(allocated, null_value);
+    }
+
+    stack.high_water = high_water;
+    return true;
 }
 
 int xvm::get_function_index_by_name(int script_index, const char* str)
@@ -1334,9 +4485,9 @@ int xvm::get_function_index_by_name(int script_index, const char* str)
     string fname = str;
     string_to_upper(const_cast<char*>(fname.c_str()));
 
-    for(int i = 0; i < scripts[script_index].function_table.size(); ++i)
+    for(int i = 0; i < scripts[script_index].image->function_table.size(); ++i)
     {
-        if(fname == scripts[script_index].function_table[i].name)
+        if(fname == scripts[script_index].image->function_table[i].name)
         {
             return i;
         }
@@ -1345,14 +4496,41 @@ int xvm::get_function_index_by_name(int script_index, const char* str)
     return -1;
 }
 
-function xvm::get_function(int script_index, int index)
+const function& xvm::get_function(int script_index, int index)
 {
-    return scripts[script_index].function_table[index];
+    return scripts[script_index].image->function_table[index];
 }
 
 string xvm::get_host_api(int index)
 {
-    return scripts[current_thread].host_api_table[index];
+    return scripts[worker().current_thread].image->host_api_table[index];
+}
+
+void xvm::bind_host_apis(int script_index)
+{
+    script& s = scripts[script_index];
+    host_api_binding unbound = { NULL, NULL };
+    s.host_api_bindings.assign(s.image->host_api_table.size(), unbound);
+
+    for(int i = 0; i < s.image->host_api_table.size(); ++i)
+    {
+        //the first function registered under the name, either for this script or globally, wins
+        for(int j = 0; j < host_apis.size(); ++j)
+        {
+            if(s.image->host_api_table[i] != host_apis[j].name)
+            {
+                continue;
+            }
+
+            int thread_index = host_apis[j].thread_index;
+            if(thread_index == script_index || thread_index == XS_GLOBAL_FUNC)
+            {
+                s.host_api_bindings[i].function = host_apis[j].function;
+                s.host_api_bindings[i].user_data = host_apis[j].user_data;
+                break;
+            }
+        }
+    }
 }
 
 int xvm::get_current_time()
@@ -1360,53 +4538,460 @@ int xvm::get_current_time()
     return get_tick_count();
 }
 
-void xvm::call_function(int script_index, int index)
+bool xvm::call_function(int script_index, int index)
 {
-    function f = get_function(script_index, index);
-
-    //save the current stack frame index
-    int frame = scripts[script_index].stack.frame;
+    //the first call into a lazily loaded function decodes it
+    program_image& image = *scripts[script_index].image;
+    if(!__atomic_load_n(&image.function_table[index].is_decoded, __ATOMIC_ACQUIRE) && !decode_function(image, index))
+    {
+        raise_script_error(script_index, XS_RUNTIME_ERROR_INVALID_CODE);
+        return false;
+    }
 
-    //push the return address, which is the current instruction
-    xvm_value return_address;
-    return_address.instruction_index = scripts[script_index].code_stream.current_code;
-    push(script_index, return_address);
+    //the host passes the parameters of the functions it calls, so the callee's frame may not sit on them
+    script& s = scripts[script_index];
+    if(s.stack.top - image.function_table[index].param_count < s.stack.frame)
+    {
+        raise_script_error(script_index, XS_RUNTIME_ERROR_STACK_UNDERFLOW);
+        return false;
+    }
 
-    //push the stack frame +1(the extra space is for the function index we'll put on the stack after it)
-    push_frame(script_index, f.local_data_size + 1);
+    const frame_descriptor& callee = image.frame_descriptors[index];
+    if(s.stack.top + callee.reserve_size > s.stack.high_water && !grow_stack(script_index, s.stack.top + callee.reserve_size))
+    {
+        return false;
+    }
 
-    //write the function index and old stack frame to the top of the stack
-    xvm_value current_function_data;
-    current_function_data.function_index = index;
-    current_function_data.offset_index = frame;
-    set_stack_value(script_index, scripts[script_index].stack.top - 1, current_function_data);
+    //save the return address, which is the current instruction, and the current stack frame index
+    call_frame frame;
+    frame.callee = &callee;
+    frame.return_code = s.code_stream.current_code;
+    frame.saved_frame = s.stack.frame;
+    frame.is_stack_base = false;
+    s.call_stack.push_back(frame);
+
+    //push the stack frame. the return address and frame record slots are only tagged, so stale
+    //values left in them aren't taken for live strings
+    s.stack.elements[s.stack.top].type = OP_TYPE_INSTR_INDEX;
+    s.stack.top += callee.frame_size;
+    s.stack.frame = s.stack.top;
+    s.stack.elements[s.stack.top - 1].type = OP_TYPE_STACK_FRAME_MARKER;
 
     //let the caller make the jump to the entry point
-    scripts[script_index].code_stream.current_code = f.entry_point;
+    s.code_stream.current_code = callee.entry_point;
+    return true;
+}
+
+//stops the script, it's only started again once it has been reset
+void xvm::raise_script_error(int script_index, int error_code)
+{
+    scripts[script_index].runtime_error = error_code;
+    scripts[script_index].is_running = false;
+    update_schedule(script_index);
+}
+
+//kept out of line so the check doesn't grow every operand access it's inlined into
+__attribute__((noinline)) xvm_value* xvm::raise_index_error(script& s)
+{
+    raise_script_error(worker().current_thread, XS_RUNTIME_ERROR_INDEX_OUT_OF_RANGE);
+    return &s.scratch_value;
+}
+
+//multiplicative hash over eight bytes at a time, concatenation results can be long
+static unsigned int hash_string(const string& str)
+{
+    const char* data = str.data();
+    size_t size = str.size();
+    unsigned long long hash = 0x9e3779b97f4a7c15ull ^ size;
+
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8)
+    {
+        unsigned long long word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+
+    unsigned long long tail = 0;
+    memcpy(&tail, data + i, size - i);
+    hash = (hash ^ tail) * 0xff51afd7ed558ccdull;
+    hash ^= hash >> 29;
+
+    return static_cast<unsigned int>(hash);
 }
 
-int xvm::add_string_if_new(const string& str)
+int xvm::find_string_bucket(const std::vector<int>& buckets, const string_vector& table,
+                            const std::vector<unsigned int>& hashes, int first_index, const string& str, unsigned int hash)
 {
-    for(int i = 0; i < scripts[current_thread].string_table.size(); ++i)
+    int mask = buckets.size() - 1;
+
+    //linear probing, stops at the matching string or the first empty bucket
+    for(int bucket = hash & mask; ; bucket = (bucket + 1) & mask)
     {
-        if(scripts[current_thread].string_table[i] == str)
+        int index = buckets[bucket];
+        if(index < 0)
         {
-            return i;
+            return bucket;
+        }
+
+        const string& candidate = table[index - first_index];
+        if(hashes[index - first_index] == hash && candidate.size() == str.size() &&
+           memcmp(candidate.data(), str.data(), str.size()) == 0)
+        {
+            return bucket;
+        }
+    }
+}
+
+void xvm::build_string_index(std::vector<int>& buckets, const string_vector& table,
+                             const std::vector<unsigned int>& hashes, int first_index)
+{
+    //keep the buckets at most half full
+    int bucket_count = MIN_STRING_BUCKET_COUNT;
+    while(bucket_count < table.size() * 2)
+    {
+        bucket_count *= 2;
+    }
+
+    buckets.assign(bucket_count, -1);
+    for(int i = 0; i < table.size(); ++i)
+    {
+        //a duplicate keeps resolving to its first occurrence
+        int bucket = find_string_bucket(buckets, table, hashes, first_index, table[i], hashes[i]);
+        if(buckets[bucket] < 0)
+        {
+            buckets[bucket] = first_index + i;
         }
     }
+}
+
+void xvm::index_image_strings(program_image& image)
+{
+    //the literals are hashed once for every instance
+    image.string_hashes.resize(image.string_table.size());
+    for(int i = 0; i < image.string_table.size(); ++i)
+    {
+        image.string_hashes[i] = hash_string(image.string_table[i]);
+    }
+
+    build_string_index(image.string_buckets, image.string_table, image.string_hashes, 0);
+}
 
-    scripts[current_thread].string_table.push_back(str);
-    return scripts[current_thread].string_table.size() - 1;
+void xvm::rebuild_string_index(int script_index)
+{
+    script& s = scripts[script_index];
+    build_string_index(s.string_buckets, s.string_table, s.string_hashes, s.pinned_string_count);
 }
 
-string xvm::get_string(int sindex)
+int xvm::add_string_if_new(int script_index, const string& str)
 {
-    if(sindex >= scripts[current_thread].string_table.size())
+    script& s = scripts[script_index];
+    const program_image& image = *s.image;
+    unsigned int hash = hash_string(str);
+
+    //a literal keeps its own index, the code stream compares against it
+    int bucket = find_string_bucket(image.string_buckets, image.string_table, image.string_hashes, 0, str, hash);
+    if(image.string_buckets[bucket] >= 0)
     {
-        return "";
+        return image.string_buckets[bucket];
+    }
+
+    //the instance's own index is only built once it makes its first string
+    if(s.string_buckets.empty())
+    {
+        rebuild_string_index(script_index);
+    }
+
+    bucket = find_string_bucket(s.string_buckets, s.string_table, s.string_hashes, s.pinned_string_count, str, hash);
+    if(s.string_buckets[bucket] >= 0)
+    {
+        return s.string_buckets[bucket];
+    }
+
+    int index = s.pinned_string_count + s.string_table.size();
+    s.string_table.push_back(str);
+    s.string_hashes.push_back(hash);
+    s.string_buckets[bucket] = index;
+
+    if(s.string_table.size() * 2 > s.string_buckets.size())
+    {
+        rebuild_string_index(script_index);
+    }
+
+    return index;
+}
+
+void xvm::concat_string(int script_index, xvm_value& dest, const string& source)
+{
+    script& s = scripts[script_index];
+
+    if(dest.type == OP_TYPE_STRING_INDEX)
+    {
+        //start a builder from the interned string
+        int builder_index = s.string_builders.size();
+        s.string_builders.push_back(get_script_string(s, dest.string_index));
+        dest.type = STRING_BUILDER_TYPE(builder_index);
+    }
+    else if(IS_STRING_BUILDER(dest.type))
+    {
+        //a copy of this value has already appended past its end, so continue on a builder of our own
+        int builder_index = STRING_BUILDER_INDEX(dest.type);
+        if(s.string_builders[builder_index].size() != dest.string_length)
+        {
+            int new_builder_index = s.string_builders.size();
+            s.string_builders.push_back(s.string_builders[builder_index].substr(0, dest.string_length));
+            dest.type = STRING_BUILDER_TYPE(new_builder_index);
+        }
+    }
+    else
+    {
+        return;
+    }
+
+    string& builder = s.string_builders[STRING_BUILDER_INDEX(dest.type)];
+    builder.append(source);
+    dest.string_length = builder.size();
+}
+
+string xvm::get_builder_string(int script_index, const xvm_value& v)
+{
+    const string& builder = scripts[script_index].string_builders[STRING_BUILDER_INDEX(v.type)];
+    return builder.substr(0, v.string_length);
+}
+
+char xvm::get_string_char(int script_index, const xvm_value& v, int index)
+{
+    //read builders in place instead of copying the whole prefix out
+    if(IS_STRING_BUILDER(v.type))
+    {
+        const string& builder = scripts[script_index].string_builders[STRING_BUILDER_INDEX(v.type)];
+        return index >= 0 && index < v.string_length ? builder[index] : '\0';
+    }
+
+    //the index is the script's, so anything out of the string reads as its terminator
+    if(v.type == OP_TYPE_STRING_INDEX)
+    {
+        const string& str = get_string(v.string_index);
+        return index >= 0 && index < (int)str.size() ? str[index] : '\0';
+    }
+
+    string str = cast_value_to_string(v);
+    return index >= 0 && index < (int)str.size() ? str[index] : '\0';
+}
+
+void xvm::flatten_string(int script_index, xvm_value& v)
+{
+    if(IS_STRING_BUILDER(v.type))
+    {
+        int string_index = add_string_if_new(script_index, get_builder_string(script_index, v));
+        v.type = OP_TYPE_STRING_INDEX;
+        v.string_index = string_index;
+    }
+}
+
+void xvm::xvm_set_string_gc_thresholds(int min_string_count, int growth_percent)
+{
+    gc_min_string_count = min_string_count;
+    gc_growth_percent = growth_percent;
+
+    for(int i = 0; i < scripts.size(); ++i)
+    {
+        if(scripts[i].is_active)
+        {
+            scripts[i].string_gc_threshold = get_string_gc_threshold(scripts[i].pinned_string_count + scripts[i].string_table.size() + scripts[i].string_builders.size());
+        }
+    }
+}
+
+void xvm::xvm_get_string_gc_stats(xvm_gc_stats& stats)
+{
+    stats = gc_stats;
+}
+
+int xvm::get_string_gc_threshold(int live_count)
+{
+    long long threshold = live_count + static_cast<long long>(live_count) * gc_growth_percent / 100;
+    return threshold > gc_min_string_count ? threshold : gc_min_string_count;
+}
+
+void xvm::collect_strings_step()
+{
+    //collect at most one script per step, so a pause never covers more than one string table.
+    //a step looks at one slab's worth of slots, however many scripts are loaded
+    int slot_count = scripts.size();
+    for(int i = 0; i < SCRIPT_SLAB_SIZE && i < slot_count; ++i)
+    {
+        int script_index = gc_cursor % slot_count;
+        gc_cursor = (script_index + 1) % slot_count;
+
+        const script& s = scripts[script_index];
+        if(s.is_active && s.pinned_string_count + s.string_table.size() + s.string_builders.size() > s.string_gc_threshold)
+        {
+            collect_strings(script_index);
+            return;
+        }
+    }
+}
+
+void xvm::collect_strings(int script_index)
+{
+    unsigned long long start_time = get_tick_count_us();
+    script& s = scripts[script_index];
+    value_vector& elements = s.stack.elements;
+    int string_count = s.pinned_string_count + s.string_table.size();
+    int builder_count = s.string_builders.size();
+
+    //mark: the literals in the image always stay, everything else has to be
+    //referenced from the live part of the stack or from _RetVal
+    std::vector<int> remap(string_count, -1);
+    for(int i = 0; i < s.pinned_string_count; ++i)
+    {
+        remap[i] = i;
+    }
+    for(int i = 0; i < s.stack.top; ++i)
+    {
+        if(elements[i].type == OP_TYPE_STRING_INDEX && elements[i].string_index >= 0 && elements[i].string_index < string_count)
+        {
+            remap[elements[i].string_index] = 0;
+        }
+    }
+    if(s._RetVal.type == OP_TYPE_STRING_INDEX && s._RetVal.string_index >= 0 && s._RetVal.string_index < string_count)
+    {
+        remap[s._RetVal.string_index] = 0;
+    }
+
+    //builders are kept up to the longest prefix still referenced
+    std::vector<int> builder_lengths(builder_count, -1);
+    for(int i = 0; i <= s.stack.top; ++i)
+    {
+        const xvm_value& v = i < s.stack.top ? elements[i] : s._RetVal;
+        if(IS_STRING_BUILDER(v.type) && v.string_length > builder_lengths[STRING_BUILDER_INDEX(v.type)])
+        {
+            builder_lengths[STRING_BUILDER_INDEX(v.type)] = v.string_length;
+        }
+    }
+
+    //compact: slide the live strings down and record where each one went
+    int live_count = s.pinned_string_count;
+    long long bytes_reclaimed = 0;
+    for(int i = s.pinned_string_count; i < string_count; ++i)
+    {
+        int from = i - s.pinned_string_count;
+        if(remap[i] < 0)
+        {
+            bytes_reclaimed += s.string_table[from].size();
+            continue;
+        }
+
+        remap[i] = live_count;
+        if(live_count != i)
+        {
+            int to = live_count - s.pinned_string_count;
+            s.string_table[to].swap(s.string_table[from]);
+            s.string_hashes[to] = s.string_hashes[from];
+        }
+        ++live_count;
+    }
+    s.string_table.resize(live_count - s.pinned_string_count);
+    s.string_hashes.resize(live_count - s.pinned_string_count);
+
+    std::vector<int> builder_remap(builder_count, -1);
+    int live_builder_count = 0;
+    for(int i = 0; i < builder_count; ++i)
+    {
+        if(builder_lengths[i] < 0)
+        {
+            bytes_reclaimed += s.string_builders[i].size();
+            continue;
+        }
+
+        bytes_reclaimed += s.string_builders[i].size() - builder_lengths[i];
+        s.string_builders[i].resize(builder_lengths[i]);
+        builder_remap[i] = live_builder_count;
+        if(live_builder_count != i)
+        {
+            s.string_builders[live_builder_count].swap(s.string_builders[i]);
+        }
+        ++live_builder_count;
+    }
+    s.string_builders.resize(live_builder_count);
+
+    //remap the references. stale values above the top are cleared so they can't outlive their strings
+    for(int i = 0; i < elements.size(); ++i)
+    {
+        if(IS_STRING_BUILDER(elements[i].type))
+        {
+            if(i < s.stack.top)
+            {
+                elements[i].type = STRING_BUILDER_TYPE(builder_remap[STRING_BUILDER_INDEX(elements[i].type)]);
+            }
+            else
+            {
+                elements[i].type = OP_TYPE_NULL;
+            }
+            continue;
+        }
+
+        if(elements[i].type != OP_TYPE_STRING_INDEX)
+        {
+            continue;
+        }
+
+        if(i < s.stack.top && elements[i].string_index >= 0 && elements[i].string_index < string_count)
+        {
+            elements[i].string_index = remap[elements[i].string_index];
+        }
+        else
+        {
+            elements[i].type = OP_TYPE_NULL;
+        }
+    }
+    if(s._RetVal.type == OP_TYPE_STRING_INDEX && s._RetVal.string_index >= 0 && s._RetVal.string_index < string_count)
+    {
+        s._RetVal.string_index = remap[s._RetVal.string_index];
+    }
+    if(IS_STRING_BUILDER(s._RetVal.type))
+    {
+        s._RetVal.type = STRING_BUILDER_TYPE(builder_remap[STRING_BUILDER_INDEX(s._RetVal.type)]);
+    }
+
+    rebuild_string_index(script_index);
+    s.string_gc_threshold = get_string_gc_threshold(live_count + live_builder_count);
+
+    int pause = get_tick_count_us() - start_time;
+    ++gc_stats.collection_count;
+    gc_stats.strings_reclaimed += string_count - live_count + builder_count - live_builder_count;
+    gc_stats.bytes_reclaimed += bytes_reclaimed;
+    gc_stats.total_pause_us += pause;
+    gc_stats.last_pause_us = pause;
+    if(pause > gc_stats.max_pause_us)
+    {
+        gc_stats.max_pause_us = pause;
+    }
+}
+
+const string& xvm::get_string(int sindex)
+{
+    static const string empty_string;
+    const script& s = scripts[worker().current_thread];
+    if(sindex < 0 || sindex >= s.pinned_string_count + s.string_table.size())
+    {
+        return empty_string;
+    }
+
+    return get_script_string(s, sindex);
+}
+
+inline const string& xvm::get_script_string(const script& s, int sindex)
+{
+    //literals are shared through the image, the rest belong to the instance
+    if(sindex < s.pinned_string_count)
+    {
+        return s.image->string_table[sindex];
     }
 
-    return scripts[current_thread].string_table[sindex];
+    return s.string_table[sindex - s.pinned_string_count];
 }
     
 }//namespace xvm
@@ -9,39 +9,98 @@
 #include <time.h>
 #include <ctype.h> 
 #include <assert.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <vector>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "xvm_interface.hpp"
+#include "xvm_jit.hpp"
 #include "../common/instruction.hpp"
 #include "../common/utility.hpp"
+#include "../common/xse_format.hpp"
 
 namespace xscript {
 namespace xvm {
 
-//script loading
+//script loading, v2 executables are described in xse_format.hpp
 #define     EXEC_FILE_EXT               ".XSE"
 #define     XSE_ID_STRING               "XSE0"
 #define     MAJOR_VERSION               0
 #define     MINOR_VERSION               8
-#define     MAX_THREAD_COUNT            1024//the maximum number of scripts that can be loaded at once.
+
+//executables larger than this are mapped instead of read
+#define     XSE_MAP_THRESHOLD           (256 * 1024)
+#define     SCRIPT_SLAB_BITS            6//script slots are allocated 64 at a time
+#define     SCRIPT_SLAB_SIZE            (1 << SCRIPT_SLAB_BITS)
+#define     MAX_WORKER_COUNT            64//the maximum number of OS threads running scripts at once
 #define     DEF_STACK_SIZE              1024
+#define     MAX_VERIFIED_DATA_SIZE      (1 << 20)//the most slots the verifier accepts for the globals or one function's parameters and locals
+#define     STACK_SEGMENT_SIZE          64//runtime stacks are allocated and grown this many slots at a time
 #define     MAX_COERCION_STRING_SIZE    64//the maximum allocated space for a string coercion
-#define     MAX_HOST_API_SIZE           1024//maximum number of functions in the host API
 #define     MAX_FUNC_NAME_SIZE          256
+#define     MAX_OPERAND_COUNT           3//the widest instructions(Jcc, GetChar, SetChar) take three operands
+#define     MIN_STRING_BUCKET_COUNT     64//initial size of a script's string intern index
+#define     DEF_STRING_GC_MIN_COUNT     1024//a script's string table isn't collected below this many strings
+#define     DEF_STRING_GC_GROWTH        100//percentage the table may grow past its live size before the next collection
 
 //multithreading
 #define     THREAD_PRIORITY_DUR_LOW     20//low-priority thread timeslice
 #define     THREAD_PRIORITY_DUR_MED     40
 #define     THREAD_PRIORITY_DUR_HIGH    80
+#define     FUEL_PER_TIMESLICE_MS       50000//instructions a millisecond of timeslice buys in fuel mode
+
+//sleeping scripts are kept in a hierarchical timer wheel, each level's slots span a whole turn of the level below
+#define     TIMER_WHEEL_BITS            8
+#define     TIMER_WHEEL_SLOTS           (1 << TIMER_WHEEL_BITS)
+#define     TIMER_WHEEL_MASK            (TIMER_WHEEL_SLOTS - 1)
+#define     TIMER_WHEEL_LEVELS          4//4 levels of 8 bits cover every millisecond time
+
+//JIT tier
+#define     JIT_HOT_CALL_COUNT          1000//calls before a function is compiled
+#define     JIT_HOT_BACK_EDGE_COUNT     1000//loop iterations before a function is compiled
+#define     JIT_BACK_EDGE_BUDGET        10000//back edges native code may take before returning to the scheduler
+
+//the direct-threaded engine relies on the GCC "labels as values" extension
+#if defined(__GNUC__)
+#define     XVM_HAS_COMPUTED_GOTO       1
+#else
+#define     XVM_HAS_COMPUTED_GOTO       0
+#endif
 
 enum XVM_THREAD_MODE
 {
     THREAD_MODE_MULTI = 0,
     THREAD_MODE_SINGLE,
+    THREAD_MODE_WORKER,//a pool worker runs one script until its timeslice is over or it stops being ready
+};
+
+//scheduler queue a script is linked into
+enum XVM_SCHEDULE_QUEUE
+{
+    SCHEDULE_QUEUE_NONE = 0,//not loaded or not running
+    SCHEDULE_QUEUE_READY,//running
+    SCHEDULE_QUEUE_SLEEPING,//running but paused until pause_end_time, linked into a timer wheel slot
 };
 
-//runtime value
+//what the scheduler found for the next instruction
+enum XVM_SCHEDULE_RESULT
+{
+    SCHEDULE_RUN = 0,//execute current_thread
+    SCHEDULE_IDLE,//every running script is paused
+    SCHEDULE_DONE,//no script is running
+};
+
+//runtime value, a type tag and a 32-bit payload packed into 8 bytes so stack slots and _RetVal copy as one move
 struct xvm_value
 {
     int type;
@@ -56,16 +115,32 @@ struct xvm_value
         int function_index;
         int host_api_index;
         int reg;
+        int string_length;
     };
-    int offset_index;
 };
 typedef std::vector<xvm_value> value_vector;
 
-//runtime stack
+//instruction operand, only relative stack indices need the extra offset index
+struct xvm_operand : public xvm_value
+{
+    int offset_index;
+};
+
+//a string being built by CONCAT packs the builder index above the 8-bit type tag(OP_TYPE_STRING_BUILDER)
+//and keeps the length of the prefix it refers to in the payload. builders are only ever appended to,
+//so copies of the value keep seeing the same string
+#define     STRING_BUILDER_TYPE(builder_index)          (OP_TYPE_STRING_BUILDER | ((builder_index) << 8))
+#define     IS_STRING_BUILDER(type)                     (((type) & 0xff) == OP_TYPE_STRING_BUILDER)
+#define     STRING_BUILDER_INDEX(type)                  ((type) >> 8)
+
+//runtime stack. it starts with room for the globals and _Main's frame and grows in segments as
+//calls and pushes need more, a script that would go past size is stopped with a stack overflow.
+//slots at or above the high water mark haven't been written since the last reset and are still null
 struct runtime_stack
 {
     value_vector elements;
-    int size;
+    int high_water;//slots handed out since the last reset, whole segments. pushes past it take the slow path
+    int size;//the most slots the stack may grow to
 
     int top;
     int frame;
@@ -75,40 +150,205 @@ struct runtime_stack
 struct function
 {
     int entry_point;
+    int code_end;//one past the function's last instruction
     int param_count;
     int local_data_size;
     int stack_frame_size;
+    int operand_depth;//most values the function's code pushes at once as the assembler worked it out, XSE2_STACK_DEPTH_UNKNOWN if it didn't
     string name;
+    bool is_decoded;//the function's code is ready to run, set under the image's decode lock
+
+    //JIT tier
+    int call_count;
+    int back_edge_count;
+    bool is_jit_failed;
+    jit_code* native;
 };
 
 typedef std::vector<function> function_vector;
 
+//what CALL and RET need to know about a function, precomputed when the image is loaded and never
+//changed, so the call path stays on a few compact records away from the names and JIT counters
+struct frame_descriptor
+{
+    int entry_point;
+    int frame_size;//slots CALL pushes: the return address, the locals and the frame record
+    int reserve_size;//slots CALL hands out: the frame plus the operand depth when it's known
+    int stack_frame_size;//slots RET pops below the frame record: parameters, return address and locals
+    int function_index;
+};
+typedef std::vector<frame_descriptor> frame_descriptor_vector;
+
+//an active call. the value stack still reserves the return address and frame record slots because
+//the compiler's stack indices count them, but the return state lives on the script's call stack
+struct call_frame
+{
+    const frame_descriptor* callee;
+    int return_code;
+    int saved_frame;
+    bool is_stack_base;//returning from it hands control back to the host
+};
+typedef std::vector<call_frame> call_frame_vector;
+
+//quickened instruction variants, specialized on operand kinds at load time
+//STACK is an absolute(global or frame relative) stack index, LITERAL any int/float/string literal
+enum XVM_QUICK_OPCODE
+{
+    QINSTR_NONE = -1,//no specialization, the generic handler is used
+
+    QINSTR_MOV_STACK_STACK = 0,
+    QINSTR_MOV_STACK_LITERAL,
+    QINSTR_MOV_STACK_REG,
+    QINSTR_MOV_REG_STACK,
+
+    QINSTR_ADD_STACK_STACK,
+    QINSTR_ADD_STACK_INT,
+    QINSTR_SUB_STACK_STACK,
+    QINSTR_SUB_STACK_INT,
+    QINSTR_MUL_STACK_STACK,
+    QINSTR_MUL_STACK_INT,
+    QINSTR_INC_STACK,
+    QINSTR_DEC_STACK,
+
+    QINSTR_JE_STACK_STACK,
+    QINSTR_JE_STACK_INT,
+    QINSTR_JNE_STACK_STACK,
+    QINSTR_JNE_STACK_INT,
+    QINSTR_JG_STACK_STACK,
+    QINSTR_JG_STACK_INT,
+    QINSTR_JL_STACK_STACK,
+    QINSTR_JL_STACK_INT,
+    QINSTR_JGE_STACK_STACK,
+    QINSTR_JGE_STACK_INT,
+    QINSTR_JLE_STACK_STACK,
+    QINSTR_JLE_STACK_INT,
+
+    QINSTR_PUSH_STACK,
+    QINSTR_PUSH_LITERAL,
+    QINSTR_PUSH_REG,
+    QINSTR_POP_STACK,
+    QINSTR_POP_REG,
+
+    QINSTR_COUNT,
+};
+
+//the threaded dispatch table holds the generic handlers (one per opcode and superinstruction
+//plus a catch-all), followed by the quickened ones, the handler that enters JIT compiled code and the unchecked stack handlers
+#define     XVM_QUICK_HANDLER_BASE      (INSTR_SUPER_LAST + 2)
+#define     XVM_JIT_HANDLER_INDEX       (XVM_QUICK_HANDLER_BASE + QINSTR_COUNT)
+//push and pop handlers without the stack checks, for proven images: PUSH, CMP_PUSH, POP, then the quickened pushes and pops
+#define     XVM_UNCHECKED_HANDLER_BASE  (XVM_JIT_HANDLER_INDEX + 1)
+#define     XVM_HANDLER_COUNT           (XVM_UNCHECKED_HANDLER_BASE + 3 + QINSTR_POP_REG - QINSTR_PUSH_STACK + 1)
+
 //instruction
+//operands are stored inline, so the whole code stream is one contiguous buffer of fixed-size
+//records and the interpreter never chases a per-instruction heap pointer
 struct xvm_code
 {
+    void* handler;//pre-decoded handler address used by the threaded engine
     int opcode;
+    int quick_opcode;//XVM_QUICK_OPCODE, set by the quickening pass
     int opcount;
-    value_vector oplist;
+    xvm_operand oplist[MAX_OPERAND_COUNT];
+    int function_index;//function the instruction belongs to, -1 if none
+};
+
+//instruction storage of an image. it comes from calloc, so the pages of functions a lazily
+//loaded image never decodes are never touched and cost no memory
+class xvm_code_vector
+{
+public:
+    xvm_code_vector() : codes(NULL), count(0) {}
+    ~xvm_code_vector() { free(codes); }
+
+    void resize(int size)
+    {
+        free(codes);
+        codes = static_cast<xvm_code*>(calloc(size > 0 ? size : 1, sizeof(xvm_code)));
+        count = size;
+    }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    xvm_code& operator[](int index) { return codes[index]; }
+    const xvm_code& operator[](int index) const { return codes[index]; }
+
+private:
+    xvm_code_vector(const xvm_code_vector&);
+    xvm_code_vector& operator=(const xvm_code_vector&);
+
+    xvm_code* codes;
+    int count;
 };
-typedef std::vector<xvm_code> xvm_code_vector;
 struct xvm_code_stream
 {
-    xvm_code_vector codes;
+    xvm_code* codes;//the image's instructions
     int current_code;
 };
 
 //host API call
 typedef std::vector<std::string> string_vector;
 
-//script
-struct script
+//everything read from an executable. instances loaded from the same file share one image, which
+//only the JIT tier writes to once it is loaded(call counts, native code and the handlers it patches)
+struct program_image
 {
-    bool is_active;//is this script structure in use
+    string file_name;
+    int ref_count;
 
     //header data
+    int stack_size;
     int global_data_size;
     int is_main_function_present;
     int main_function_index;
+    int priority_type;
+    int timeslice_duration;
+
+    //stack depths worked out by the verifier. a proven image knows every function's operand depth and
+    //CALL hands out enough stack for it, so pushes and pops in the threaded and JIT code skip their checks.
+    //host calls without a parameter count leave an image unproven
+    int stack_bound;//slots a run from _Main takes at most, XSE2_STACK_DEPTH_UNKNOWN if that isn't known
+    bool is_stack_proven;
+
+    function_vector function_table;
+    frame_descriptor_vector frame_descriptors;
+    xvm_code_vector codes;
+    string_vector host_api_table;
+
+    //literal strings with their intern index, they are the first entries of every instance's string table
+    string_vector string_table;
+    std::vector<int> string_buckets;
+    std::vector<unsigned int> string_hashes;
+
+    //lazily loaded images keep the executable in memory until they are released,
+    //the instructions of a function are decoded from it on the function's first call
+    const xse2_instruction* encoded_codes;//NULL if everything was decoded at load time
+    std::vector<unsigned char> file_data;
+    void* file_mapping;
+    int file_mapping_size;
+    std::mutex decode_lock;
+};
+
+//cursor over an executable mapped into memory by the loader
+struct xse_reader
+{
+    const unsigned char* data;
+    int size;
+    int offset;
+    bool is_failed;//set by the first read past the end
+};
+
+//a script's host API import resolved at load time
+struct host_api_binding
+{
+    host_api_function_ptr function;
+    void* user_data;
+};
+
+//script
+struct script
+{
+    bool is_active;//is this script structure in use
+    program_image* image;
 
     //runtime tracking
     bool is_running;
@@ -117,32 +357,99 @@ struct script
 
     //threading
     int timeslice_duration;
+    int schedule_queue;//XVM_SCHEDULE_QUEUE
+    int schedule_prev;//neighbours in the circular queue
+    int schedule_next;
+    int timer_slot;//timer wheel slot while sleeping
 
     //register file
     xvm_value _RetVal;
 
     //script data
-    function_vector function_table;
     xvm_code_stream code_stream;
-    string_vector host_api_table;
+    std::vector<host_api_binding> host_api_bindings;//the image's host_api_table resolved to functions, NULL if unregistered
+
+    //strings made at run time, numbered on from the image's literals. the intern index holds open
+    //addressed buckets of string indices(-1 when empty) and the hash of every string, so lookups
+    //compare hashes and lengths before characters
     string_vector string_table;
+    std::vector<int> string_buckets;
+    std::vector<unsigned int> string_hashes;
+    string_vector string_builders;//append-only buffers behind OP_TYPE_STRING_BUILDER values
+    int pinned_string_count;//literals in the image, the code stream refers to them directly
+    int string_gc_threshold;//table size that triggers the next collection
 
     runtime_stack stack;
+    call_frame_vector call_stack;
+
+    int runtime_error;//SCRIPT_RUNTIME_ERROR_CODE, a script stopped by an error stays stopped until it's reset
+    xvm_value scratch_value;//stands in for an array element out of range, so the instruction completes before the script stops
+    int pool_index;//pool the script goes back to when it's released, -1 if it isn't pooled
+    bool is_pooled_idle;//waiting in its pool's idle list, so it can't be released again
+};
+
+//loaded, reset and stopped instances of one executable waiting to be acquired
+struct script_pool
+{
+    bool is_active;//destroyed pools unload their instances as they are released
+    string file_name;
+    int thread_timeslice;
+    std::vector<int> idle_scripts;
+};
+
+//execution state of an OS thread running scripts. the host's thread is worker 0,
+//the others belong to the worker pool
+struct xvm_worker
+{
+    int current_thread;
+    int current_thread_mode;
+    int current_thread_active_time;
+    int thread_fuel;//instructions the current thread has left in fuel mode
+    int run_depth;//xvm_run_script nesting, host functions may call back into the VM
+
+    //scripts dealt to this worker for the current round. the owner takes from the back,
+    //idle workers steal from the front
+    std::deque<int> work;
+    std::mutex work_mutex;
+
+    //functions this worker found hot or broken during a round, the host's thread compiles
+    //or releases them once the round is over
+    std::vector<std::pair<program_image*, int> > jit_requests;
 };
 
 //host API
 struct host_api_function
 {
-    int is_active;
     int thread_index;
 
     string name;
     host_api_function_ptr function;
+    void* user_data;
+};
+
+//script slots, handed out from slabs that are never moved or freed while the VM is up, so a script
+//index stays valid until the script is unloaded. free slots are reused last in, first out
+class script_table
+{
+public:
+    ~script_table();
+
+    script& operator[](int index) { return slabs[index >> SCRIPT_SLAB_BITS][index & (SCRIPT_SLAB_SIZE - 1)]; }
+    int size() const { return slabs.size() * SCRIPT_SLAB_SIZE; }
+
+    int get_free_slot();//the slot the next load goes to, adding a slab if none is free
+    void take_free_slot();
+    void release_slot(int index);
+    void clear();
+
+private:
+    std::vector<script*> slabs;
+    std::vector<int> free_slots;
 };
 
 //Macros
-#define resolve_stack_index(index) (index < 0 ? index += scripts[current_thread].stack.frame : index)
-#define is_valid_thread_index(index) (index < 0 || index > MAX_THREAD_COUNT ? false : true)
+#define resolve_stack_index(index) (index < 0 ? index += scripts[worker().current_thread].stack.frame : index)
+#define is_valid_thread_index(index) (index < 0 || index >= scripts.size() ? false : true)
 #define is_thread_active(index) (is_valid_thread_index(index) && scripts[index].is_active ? true : false)
 
 class xvm : public xvm_interface
@@ -152,12 +459,18 @@ public:
     ~xvm();
 
     //------------script interface---------------//
-    void xvm_init();
+    void xvm_init(int engine = XS_EXEC_ENGINE_THREADED);
     void xvm_shutdown();
 
     int xvm_load_script(const char* script_name, int& script_index, int thread_timeslice);
     void xvm_unload_script(int script_index);
     void xvm_reset_script(int script_index);
+    int xvm_get_script_error(int script_index);
+
+    int xvm_create_script_pool(const char* script_name, int instance_count, int thread_timeslice, int& pool_index);
+    void xvm_destroy_script_pool(int pool_index);
+    int xvm_acquire_script(int pool_index);
+    void xvm_release_script(int script_index);
 
     void xvm_run_script(int timeslice_duration);
 
@@ -177,8 +490,20 @@ public:
     void xvm_call_script_function(int script_index, const char* fname);
     void xvm_invoke_script_function(int script_index, const char* fname);
 
+    void xvm_set_jit_mode(int mode);
+    int xvm_get_jit_mismatch_count();
+
+    void xvm_set_timeslice_mode(int mode);
+    void xvm_set_worker_count(int count);
+    void xvm_set_idle_mode(int mode);
+    void xvm_set_load_mode(int mode);
+    int xvm_get_sleep_time();
+
+    void xvm_set_string_gc_thresholds(int min_string_count, int growth_percent);
+    void xvm_get_string_gc_stats(xvm_gc_stats& stats);
+
     //------------host API interface---------------//
-    void xvm_register_host_api(int script_index, const char* fname, host_api_function_ptr fn);
+    void xvm_register_host_api(int script_index, const char* fname, host_api_function_ptr fn, void* user_data = NULL);
 
     int xvm_get_param_as_int(int script_index, int param_index);
     float xvm_get_param_as_float(int script_index, int param_index);
@@ -190,6 +515,46 @@ public:
     void xvm_return_string_from_host(int script_index, int param_count, char* str);
   
 private:      
+    //------------execution engines----------------//
+    void execute_switch(int timeslice_duration);
+    void execute_instruction(int current_time, int& is_exit_execute_loop);
+    void execute_threaded(int timeslice_duration, void* const** dispatch_table = NULL);
+    void index_functions(program_image& image);
+    void quicken_code_stream(program_image& image, int first_code, int last_code);
+    void fuse_code_stream(program_image& image, int first_code, int last_code);
+    void thread_code_stream(program_image& image, int first_code, int last_code);
+    void* get_code_handler(const xvm_code& code, bool is_stack_proven);
+
+    //------------worker pool----------------------//
+    int get_worker_index() { return worker_owner == this ? worker_index : 0; }
+    xvm_worker& worker() { return workers[get_worker_index()]; }
+    void start_workers(int count);
+    void stop_workers();
+    void worker_main(int index, int round);
+    void execute_parallel(int timeslice_duration);
+    void run_worker(int timeslice_duration);
+    int take_work();
+
+    //------------program images-------------------//
+    int load_image(const char* script_name, program_image*& image);
+    int decode_image_v08(xse_reader& reader, program_image& image);
+    int decode_image_v2(xse_reader& reader, program_image& image, bool is_lazy);
+    int verify_image(program_image& image, const xse2_stack_depth* recorded_depths);
+    bool decode_function(program_image& image, int function_index);
+    void prepare_code(program_image& image, int first_code, int last_code);
+    void release_image(program_image* image);
+
+    //------------JIT tier-------------------------//
+    bool count_jit_event(int& counter, int threshold);
+    void jit_compile_function(program_image& image, int function_index);
+    void jit_release_function(program_image& image, int function_index);
+    void jit_process_requests();
+    int jit_execute(int function_index, int code_index, int& back_edge_count);
+
+    xvm_value* threaded_operand_ptr(script& s, const xvm_operand& op);
+    xvm_value threaded_operand_value(script& s, const xvm_operand& op);
+    bool is_jump_taken(script& s, int opcode, const xvm_value& v0, const xvm_value& v1);
+
     //------------operand interface----------------//
     int cast_value_to_int(const xvm_value& v);
     float cast_value_to_float(const xvm_value& v);
@@ -198,7 +563,6 @@ private:
     void copy_value(xvm_value* dest, const xvm_value& source);
 
     int get_operand_type(int index);
-    int resolve_operand_stack_index(int index);
     xvm_value resolve_operand_value(int index);
     int resolve_operand_type(int index);
     int resolve_operand_as_int(int index);
@@ -216,31 +580,104 @@ private:
     xvm_value pop(int script_index);
     void push_frame(int script_index, int size);
     void pop_frame(int size);
+    bool grow_stack(int script_index, int slot_count);
 
     //------------function table interface------------//
     int get_function_index_by_name(int script_index, const char* str);
-    function get_function(int script_index, int index);
+    const function& get_function(int script_index, int index);
 
     //------------host API interface-----------------//
     string get_host_api(int index);
+    void bind_host_apis(int script_index);
 
     //------------time-------------------------------//
     int get_current_time();
 
     //------------function---------------------------//
-    void call_function(int script_index, int index);
+    bool call_function(int script_index, int index);
+    void raise_script_error(int script_index, int error_code);
+    xvm_value* raise_index_error(script& s);
+
+    //------------scheduler--------------------------//
+    void update_schedule(int script_index);
+    void link_script(int& head, int script_index);
+    void unlink_script(int& head, int script_index);
+    int get_timer_slot(unsigned int expire_time);
+    void add_timer(int script_index, unsigned int expire_time);
+    void cascade_timers(int slot);
+    void advance_timers(int current_time);
+    int get_next_wake_time();
+    bool wait_for_wake(int main_timeslice_start_time, int timeslice_duration);
+    int schedule_thread(int current_time);
+    long long get_run_fuel(int timeslice_duration);
+    int get_thread_fuel(int script_index);
+    void charge_fuel(int amount, long long& run_fuel);
 
     //------------string table-----------------------//
-    int add_string_if_new(const string& str);
-    string get_string(int sindex);
+    int add_string_if_new(int script_index, const string& str);
+    const string& get_string(int sindex);
+    const string& get_script_string(const script& s, int sindex);
+    int find_string_bucket(const std::vector<int>& buckets, const string_vector& table,
+                           const std::vector<unsigned int>& hashes, int first_index, const string& str, unsigned int hash);
+    void build_string_index(std::vector<int>& buckets, const string_vector& table,
+                            const std::vector<unsigned int>& hashes, int first_index);
+    void index_image_strings(program_image& image);
+    void rebuild_string_index(int script_index);
+    void concat_string(int script_index, xvm_value& dest, const string& source);
+    string get_builder_string(int script_index, const xvm_value& v);
+    char get_string_char(int script_index, const xvm_value& v, int index);
+    void flatten_string(int script_index, xvm_value& v);
+    void collect_strings_step();
+    void collect_strings(int script_index);
+    int get_string_gc_threshold(int live_count);
 private:   
-    script scripts[MAX_THREAD_COUNT];
-    host_api_function host_apis[MAX_HOST_API_SIZE];
+    script_table scripts;
+    std::vector<program_image*> images;//images with at least one loaded instance
+    std::vector<script_pool> pools;
+    std::vector<host_api_function> host_apis;
 
     //threading
-    int current_thread;
-    int current_thread_mode;    
-    int current_thread_active_time;
+    xvm_worker workers[MAX_WORKER_COUNT];
+    //worker the calling OS thread runs as, threads that are not in worker_owner's pool act as the host's
+    static thread_local xvm* worker_owner;
+    static thread_local int worker_index;
+    int timeslice_mode;
+
+    //the running thread is kept at the head of the ready queue, scripts are appended at the tail
+    int ready_head;
+    int timer_slots[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];//queue heads, level by level
+    unsigned int timer_time;//last millisecond the wheel has processed
+    int sleeping_count;
+    int idle_mode;
+    int load_mode;
+    std::recursive_mutex schedule_mutex;//guards the queues while workers run
+
+    //worker pool, workers 1..worker_count - 1 wait for rounds started by the host's thread
+    int worker_count;
+    std::vector<std::thread> pool_threads;
+    std::mutex pool_mutex;
+    std::condition_variable pool_cond;
+    std::condition_variable pool_done_cond;
+    int pool_round;
+    int pool_busy_count;
+    int pool_timeslice;
+    bool is_pool_stopping;
+    bool is_pool_round_running;//instances on several workers may share an image's code
+
+    //execution engine
+    int exec_engine;
+    void* const* threaded_dispatch_table;
+
+    //JIT tier
+    jit_compiler jit;
+    int jit_mode;
+    std::atomic<int> jit_mismatch_count;
+
+    //string table garbage collection
+    int gc_cursor;//next script the collector looks at
+    int gc_min_string_count;
+    int gc_growth_percent;
+    xvm_gc_stats gc_stats;
 };
 
 }//namespace xvm
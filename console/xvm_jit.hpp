@@ -0,0 +1,60 @@
+#ifndef     __XSCRIPT_XVM_JIT_HPP__
+#define     __XSCRIPT_XVM_JIT_HPP__
+
+#include <stddef.h>
+#include <vector>
+
+namespace xscript {
+namespace xvm {
+
+struct xvm_value;
+struct xvm_code;
+
+//the template JIT only targets x86-64, elsewhere compilation fails and the interpreter keeps running
+#if defined(__x86_64__)
+#define     XVM_HAS_JIT                 1
+#else
+#define     XVM_HAS_JIT                 0
+#endif
+
+//state shared between the interpreter and compiled code
+struct jit_context
+{
+    xvm_value* elements;//runtime stack
+    xvm_value* ret_val;//_RetVal register
+    int top;
+    int frame;
+    int push_limit;//highest top a value may be pushed at, the interpreter raises the stack's high water mark past it
+    int budget;//back edges left before control goes back to the interpreter
+    int steps;//instructions executed, only counted by code compiled for cross-checking
+};
+
+//native code for one script function
+struct jit_code
+{
+    void* memory;
+    size_t size;
+
+    int first_code;//first instruction index covered
+    std::vector<int> entry_offsets;//native offset of each covered instruction
+    std::vector<int> entry_points;//instructions the interpreter should enter native code at
+};
+
+//translates the quickened instruction stream of a function into x86-64 machine code.
+//integer MOV/arithmetic/PUSH/POP/jumps on absolute stack indices are compiled with type guards,
+//everything else(CALL, RET, CALLHOST, PAUSE, string ops...) exits back to the interpreter
+class jit_compiler
+{
+public:
+    //pushes and pops aren't guarded when is_stack_proven, the caller makes sure the stack holds the function's operand depth
+    jit_code* compile(const xvm_code* codes, int first_code, int last_code, bool is_counting_steps, bool is_stack_proven);
+    void release(jit_code* native);
+
+    //runs native code starting at code_index and returns the instruction index to resume at
+    int execute(jit_code* native, jit_context* context, int code_index);
+};
+
+}//namespace xvm
+}//namespace xscript
+
+#endif      //__XSCRIPT_XVM_JIT_HPP__
@@ -7,9 +7,13 @@ g++ -o xcomplier -g  main.cpp xcomplier.cpp parser.cpp lexer.cpp i_code.cpp code
 mv xcomplier ../test/
 
 cd ../console
-g++ -o xvm -g -fpermissive -lrt xvm.cpp console.cpp
+g++ -o xvm -g -fpermissive -pthread -lrt xvm.cpp xvm_jit.cpp console.cpp
 mv xvm ../test/
 
 cd ../test
+g++ -o vm_test -g -fpermissive -pthread vm_test.cpp ../xvm/xvm.cpp ../xvm/xvm_jit.cpp -lrt
+./xcomplier count.xss > /dev/null
+./vm_test || exit 1
+
 ./xcomplier t.xss
 ./xvm t.xss.XSE
@@ -0,0 +1,60 @@
+//string interning benchmark: grows one script's runtime string table to 1M entries and prints the
+//cost of adding new strings and of looking up strings already in the table at every 100k entries.
+//the cost per operation should stay flat as the table grows
+#include <stdio.h>
+#include <stdlib.h>
+#include "../xvm/xvm.hpp"
+#include "../common/utility.hpp"
+
+#define     STRING_COUNT    1000000
+#define     BATCH_SIZE      100000
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2)
+    {
+        printf("Usage:\tbench_strings script.XSE\n");
+        return 1;
+    }
+
+    xscript::xvm::xvm vm;
+    vm.xvm_init();
+
+    int script_index;
+    if(vm.xvm_load_script(argv[1], script_index, XS_THREAD_PRIORITY_USER) != XS_LOAD_OK)
+    {
+        printf("ERROR: can't load %s\n", argv[1]);
+        return 1;
+    }
+
+    //host string returns intern their string without touching the stack, and the collector only
+    //runs inside xvm_run_script, so every string made here stays in the table
+    char str[32];
+    unsigned int seed = 1;
+    printf("%10s %16s %16s\n", "strings", "insert ns/op", "lookup ns/op");
+    for(int count = 0; count < STRING_COUNT; count += BATCH_SIZE)
+    {
+        unsigned long long start = get_tick_count_us();
+        for(int i = count; i < count + BATCH_SIZE; ++i)
+        {
+            sprintf(str, "string %d", i);
+            vm.xvm_return_string_from_host(script_index, 0, str);
+        }
+        unsigned long long insert_time = get_tick_count_us() - start;
+
+        start = get_tick_count_us();
+        for(int i = 0; i < BATCH_SIZE; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            sprintf(str, "string %u", (seed >> 8) % (count + BATCH_SIZE));
+            vm.xvm_return_string_from_host(script_index, 0, str);
+        }
+        unsigned long long lookup_time = get_tick_count_us() - start;
+
+        printf("%10d %16.1f %16.1f\n", count + BATCH_SIZE,
+            insert_time * 1000.0 / BATCH_SIZE, lookup_time * 1000.0 / BATCH_SIZE);
+    }
+
+    vm.xvm_shutdown();
+    return 0;
+}
@@ -0,0 +1,444 @@
+//behavior tests for the VM, run by test.sh from the test directory after it has compiled the scripts
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <mutex>
+#include "../xvm/xvm.hpp"
+
+using namespace xscript::xvm;
+
+#define     COUNT_RESULT            1249975000//sum of 0..49999, what count.xss reports
+#define     MAX_RUN_ROUNDS          1000
+
+static int failure_count = 0;
+
+static void check(bool is_passed, const char* name)
+{
+    printf("%s %s\n", is_passed ? "PASS" : "FAIL", name);
+    if(!is_passed)
+    {
+        ++failure_count;
+    }
+}
+
+//------------reported results--------------------//
+
+static std::mutex report_mutex;
+static std::map<int, int> reports;//script index -> value its Report() call passed
+
+static void host_api_report(xvm_interface* vm, int script_index, void* user_data)
+{
+    int value = vm->xvm_get_param_as_int(script_index, 0);
+    {
+        std::lock_guard<std::mutex> lock(report_mutex);
+        reports[script_index] = value;
+    }
+    vm->xvm_return_from_host(script_index, 1);
+}
+
+static int get_report_count()
+{
+    std::lock_guard<std::mutex> lock(report_mutex);
+    return reports.size();
+}
+
+//loads count instances of a script, runs them until all of them have reported and checks what they reported
+static bool run_counting_scripts(xvm& vm, int count)
+{
+    reports.clear();
+    std::vector<int> script_indices(count);
+    for(int i = 0; i < count; ++i)
+    {
+        if(vm.xvm_load_script("count.xss.XSE", script_indices[i], XS_THREAD_PRIORITY_USER) != XS_LOAD_OK)
+        {
+            return false;
+        }
+    }
+    vm.xvm_register_host_api(XS_GLOBAL_FUNC, "Report", host_api_report);
+    for(int i = 0; i < count; ++i)
+    {
+        vm.xvm_start_script(script_indices[i]);
+    }
+
+    for(int round = 0; round < MAX_RUN_ROUNDS && get_report_count() < count; ++round)
+    {
+        vm.xvm_run_script(10);
+    }
+
+    bool is_passed = get_report_count() == count;
+    for(int i = 0; i < count; ++i)
+    {
+        is_passed = is_passed && reports[script_indices[i]] == COUNT_RESULT;
+        vm.xvm_unload_script(script_indices[i]);
+    }
+    return is_passed;
+}
+
+//------------scheduling--------------------------//
+
+//the timeslice mode is set before anything is loaded, like the console does. with more than one worker
+//the scripts run in bursts on the pool, each burst has to get the script's whole timeslice
+static void test_scheduling()
+{
+    const char* mode_names[] = { "clock", "fuel" };
+    const int worker_counts[] = { 1, 4 };
+    for(int mode = XS_TIMESLICE_CLOCK; mode <= XS_TIMESLICE_FUEL; ++mode)
+    {
+        for(int i = 0; i < sizeof(worker_counts) / sizeof(worker_counts[0]); ++i)
+        {
+            xvm vm;
+            vm.xvm_init();
+            vm.xvm_set_timeslice_mode(mode);
+            vm.xvm_set_worker_count(worker_counts[i]);
+
+            char name[64];
+            sprintf(name, "scheduling: %s timeslices, %d worker(s)", mode_names[mode], worker_counts[i]);
+            check(run_counting_scripts(vm, 8), name);
+            vm.xvm_shutdown();
+        }
+    }
+}
+
+//------------instance pools----------------------//
+
+//runs one acquired instance until it reports and returns what it reported
+static int run_pooled_script(xvm& vm, int script_index)
+{
+    reports.clear();
+    vm.xvm_start_script(script_index);
+    for(int round = 0; round < MAX_RUN_ROUNDS && get_report_count() == 0; ++round)
+    {
+        vm.xvm_run_script(10);
+    }
+    return get_report_count() == 1 ? reports[script_index] : -1;
+}
+
+static void test_pools()
+{
+    xvm vm;
+    vm.xvm_init();
+    vm.xvm_register_host_api(XS_GLOBAL_FUNC, "Report", host_api_report);
+
+    int pool_index;
+    check(vm.xvm_create_script_pool("count.xss.XSE", 2, XS_THREAD_PRIORITY_USER, pool_index) == XS_LOAD_OK, "pools: create");
+
+    //two instances are loaded up front, the third acquire grows the pool
+    int first = vm.xvm_acquire_script(pool_index);
+    int second = vm.xvm_acquire_script(pool_index);
+    int third = vm.xvm_acquire_script(pool_index);
+    check(first >= 0 && second >= 0 && third >= 0 && first != second && first != third && second != third, "pools: acquire hands out distinct instances");
+
+    //a released instance comes back reset and runs from the start again
+    check(run_pooled_script(vm, first) == COUNT_RESULT, "pools: acquired instance runs");
+    vm.xvm_release_script(first);
+    int again = vm.xvm_acquire_script(pool_index);
+    check(again == first && run_pooled_script(vm, again) == COUNT_RESULT, "pools: released instance runs again");
+
+    //releasing twice must not put the instance in the idle list twice
+    vm.xvm_release_script(first);
+    vm.xvm_release_script(first);
+    int once = vm.xvm_acquire_script(pool_index);
+    int twice = vm.xvm_acquire_script(pool_index);
+    check(once == first && twice >= 0 && twice != first, "pools: double release is ignored");
+
+    //an idle instance that's unloaded leaves the pool
+    vm.xvm_release_script(second);
+    vm.xvm_unload_script(second);
+    int fresh = vm.xvm_acquire_script(pool_index);
+    check(fresh >= 0 && fresh != once && fresh != twice && fresh != third && run_pooled_script(vm, fresh) == COUNT_RESULT,
+        "pools: unloaded idle instance isn't handed out");
+
+    //nothing is handed out after the pool is destroyed, instances still out are unloaded as they come back
+    vm.xvm_destroy_script_pool(pool_index);
+    check(vm.xvm_acquire_script(pool_index) == -1, "pools: destroyed pool hands out nothing");
+    vm.xvm_release_script(once);
+    vm.xvm_release_script(twice);
+    vm.xvm_release_script(third);
+    vm.xvm_release_script(fresh);
+
+    vm.xvm_shutdown();
+}
+
+//------------patched executables-----------------//
+
+static bool read_executable(const char* file_name, std::vector<unsigned char>& bytes)
+{
+    FILE* file = fopen(file_name, "rb");
+    if(!file)
+    {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    bytes.resize(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    bool is_read = fread(&bytes[0], 1, bytes.size(), file) == bytes.size();
+    fclose(file);
+    return is_read;
+}
+
+static xscript::xse2_header* get_header(std::vector<unsigned char>& bytes)
+{
+    return reinterpret_cast<xscript::xse2_header*>(&bytes[0]);
+}
+
+static xscript::xse2_section* find_section(std::vector<unsigned char>& bytes, unsigned int type)
+{
+    xscript::xse2_section* sections = reinterpret_cast<xscript::xse2_section*>(&bytes[sizeof(xscript::xse2_header)]);
+    for(int i = 0; i < get_header(bytes)->section_count; ++i)
+    {
+        if(sections[i].type == type)
+        {
+            return &sections[i];
+        }
+    }
+    return NULL;
+}
+
+//redoes the checksums after a patch, so only the patched part is wrong
+static void seal_executable(std::vector<unsigned char>& bytes)
+{
+    xscript::xse2_header* header = get_header(bytes);
+    xscript::xse2_section* sections = reinterpret_cast<xscript::xse2_section*>(&bytes[sizeof(xscript::xse2_header)]);
+    for(int i = 0; i < header->section_count; ++i)
+    {
+        sections[i].crc = xscript::xse_crc32(&bytes[sections[i].offset], sections[i].size);
+    }
+    header->crc = 0;
+    header->crc = xscript::xse_crc32(sections, header->section_count * sizeof(xscript::xse2_section), xscript::xse_crc32(header, sizeof(xscript::xse2_header)));
+}
+
+//writes the executable out and loads it, the script is unloaded again unless script_index is asked for
+static int load_executable(xvm& vm, std::vector<unsigned char>& bytes, int* script_index = NULL)
+{
+    seal_executable(bytes);
+    FILE* file = fopen("patched.XSE", "wb");
+    fwrite(&bytes[0], 1, bytes.size(), file);
+    fclose(file);
+
+    int loaded_index;
+    int error_code = vm.xvm_load_script("patched.XSE", loaded_index, XS_THREAD_PRIORITY_USER);
+    if(error_code == XS_LOAD_OK)
+    {
+        if(script_index)
+        {
+            *script_index = loaded_index;
+        }
+        else
+        {
+            vm.xvm_unload_script(loaded_index);
+        }
+    }
+    return error_code;
+}
+
+//------------instance pool slots-----------------//
+
+static void test_pool_slots()
+{
+    xvm vm;
+    vm.xvm_init();
+
+    //a destroyed pool's slot is handed to the next pool once nothing refers to it
+    int first_index;
+    int second_index;
+    vm.xvm_create_script_pool("count.xss.XSE", 1, XS_THREAD_PRIORITY_USER, first_index);
+    vm.xvm_destroy_script_pool(first_index);
+    vm.xvm_create_script_pool("count.xss.XSE", 1, XS_THREAD_PRIORITY_USER, second_index);
+    check(second_index == first_index, "pool slots: destroyed pool's slot is reused");
+
+    //an instance still out keeps its pool's slot until it comes back
+    int instance = vm.xvm_acquire_script(second_index);
+    vm.xvm_destroy_script_pool(second_index);
+    int third_index;
+    vm.xvm_create_script_pool("count.xss.XSE", 1, XS_THREAD_PRIORITY_USER, third_index);
+    check(third_index != second_index, "pool slots: slot with an instance out isn't reused");
+    vm.xvm_release_script(instance);
+    vm.xvm_destroy_script_pool(third_index);
+
+    int fourth_index;
+    vm.xvm_create_script_pool("count.xss.XSE", 1, XS_THREAD_PRIORITY_USER, fourth_index);
+    check(fourth_index == first_index, "pool slots: slot is reused once the instance is back");
+
+    vm.xvm_shutdown();
+}
+
+//------------recorded stack depths---------------//
+
+//count.xss has _Main and nothing else, so the section holds _Main's record followed by the program's
+static void test_stack_depths()
+{
+    xvm vm;
+    vm.xvm_init();
+    vm.xvm_register_host_api(XS_GLOBAL_FUNC, "Report", host_api_report);
+
+    std::vector<unsigned char> original;
+    check(read_executable("count.xss.XSE", original) && find_section(original, xscript::XSE2_SECTION_STACK_DEPTHS),
+        "stack depths: executable has the section");
+    std::vector<unsigned char> bytes = original;
+    check(load_executable(vm, bytes) == XS_LOAD_OK, "stack depths: unpatched executable loads");
+
+    //a 2.0 executable has no stack depths, an unknown section type is skipped like a newer minor version's
+    bytes = original;
+    get_header(bytes)->minor_version = 0;
+    find_section(bytes, xscript::XSE2_SECTION_STACK_DEPTHS)->type = xscript::XSE2_SECTION_COUNT;
+    int script_index = -1;
+    check(load_executable(vm, bytes, &script_index) == XS_LOAD_OK && run_pooled_script(vm, script_index) == COUNT_RESULT,
+        "stack depths: 2.0 executable without them runs");
+    vm.xvm_unload_script(script_index);
+
+    //one record short of a record per function plus the program's
+    bytes = original;
+    xscript::xse2_section* section = find_section(bytes, xscript::XSE2_SECTION_STACK_DEPTHS);
+    --section->count;
+    section->size -= sizeof(xscript::xse2_stack_depth);
+    check(load_executable(vm, bytes) == XS_LOAD_ERROR_INVALID_XSE, "stack depths: wrong record count is rejected");
+
+    //depths no function could have
+    bytes = original;
+    xscript::xse2_stack_depth* depths = reinterpret_cast<xscript::xse2_stack_depth*>(&bytes[find_section(bytes, xscript::XSE2_SECTION_STACK_DEPTHS)->offset]);
+    depths[0].operand_depth = 0x7fffffff;
+    check(load_executable(vm, bytes) == XS_LOAD_ERROR_INVALID_XSE, "stack depths: oversized operand depth is rejected");
+
+    bytes = original;
+    depths = reinterpret_cast<xscript::xse2_stack_depth*>(&bytes[find_section(bytes, xscript::XSE2_SECTION_STACK_DEPTHS)->offset]);
+    depths[1].stack_bound = -5;
+    check(load_executable(vm, bytes) == XS_LOAD_ERROR_INVALID_XSE, "stack depths: negative program bound is rejected");
+
+    //in range but not what the code does
+    bytes = original;
+    depths = reinterpret_cast<xscript::xse2_stack_depth*>(&bytes[find_section(bytes, xscript::XSE2_SECTION_STACK_DEPTHS)->offset]);
+    ++depths[0].operand_depth;
+    check(load_executable(vm, bytes) == XS_LOAD_ERROR_INVALID_CODE, "stack depths: wrong operand depth is rejected");
+
+    bytes = original;
+    depths = reinterpret_cast<xscript::xse2_stack_depth*>(&bytes[find_section(bytes, xscript::XSE2_SECTION_STACK_DEPTHS)->offset]);
+    ++depths[1].stack_bound;
+    check(load_executable(vm, bytes) == XS_LOAD_ERROR_INVALID_CODE, "stack depths: wrong program bound is rejected");
+
+    vm.xvm_shutdown();
+}
+
+//------------verifier----------------------------//
+
+//the first instruction with the opcode whose first operand has the type
+static xscript::xse2_instruction* find_instruction(std::vector<unsigned char>& bytes, int opcode, int operand_type)
+{
+    xscript::xse2_section* section = find_section(bytes, xscript::XSE2_SECTION_CODE);
+    xscript::xse2_instruction* codes = reinterpret_cast<xscript::xse2_instruction*>(&bytes[section->offset]);
+    for(int i = 0; i < section->count; ++i)
+    {
+        if(codes[i].opcode == opcode && codes[i].opcount > 0 && codes[i].oplist[0].type == operand_type)
+        {
+            return &codes[i];
+        }
+    }
+    return NULL;
+}
+
+//each patch breaks one thing the interpreter takes for granted. a lazily loaded executable still loads,
+//_Main is verified as the load resets the script and the script gets a runtime error instead
+static void test_verifier()
+{
+    const char* patch_names[] = { "jump out of its function", "stack index below the frame", "pop of a value never pushed", "wrong recorded depth" };
+    const char* mode_names[] = { "eager", "lazy" };
+    for(int mode = XS_LOAD_EAGER; mode <= XS_LOAD_LAZY; ++mode)
+    {
+        xvm vm;
+        vm.xvm_init();
+        vm.xvm_set_load_mode(mode);
+        vm.xvm_register_host_api(XS_GLOBAL_FUNC, "Report", host_api_report);
+
+        std::vector<unsigned char> original;
+        read_executable("count.xss.XSE", original);
+        std::vector<unsigned char> bytes = original;
+        int script_index = -1;
+        char name[128];
+        sprintf(name, "verifier: unpatched executable runs(%s)", mode_names[mode]);
+        check(load_executable(vm, bytes, &script_index) == XS_LOAD_OK && run_pooled_script(vm, script_index) == COUNT_RESULT, name);
+        vm.xvm_unload_script(script_index);
+
+        for(int patch = 0; patch < sizeof(patch_names) / sizeof(patch_names[0]); ++patch)
+        {
+            bytes = original;
+            xscript::xse2_instruction* code = NULL;
+            switch(patch)
+            {
+            case 0:
+                code = find_instruction(bytes, xscript::INSTR_JMP, xscript::OP_TYPE_INSTR_INDEX);
+                code->oplist[0].index = 100000;
+                break;
+            case 1:
+                code = find_instruction(bytes, xscript::INSTR_MOV, xscript::OP_TYPE_ABS_STACK_INDEX);
+                code->oplist[0].index = -500;
+                break;
+            case 2:
+                code = find_instruction(bytes, xscript::INSTR_PUSH, xscript::OP_TYPE_ABS_STACK_INDEX);
+                code->opcode = xscript::INSTR_POP;
+                break;
+            case 3:
+                ++reinterpret_cast<xscript::xse2_stack_depth*>(&bytes[find_section(bytes, xscript::XSE2_SECTION_STACK_DEPTHS)->offset])->operand_depth;
+                break;
+            }
+
+            bool is_rejected;
+            script_index = -1;
+            int error_code = load_executable(vm, bytes, &script_index);
+            if(mode == XS_LOAD_EAGER)
+            {
+                is_rejected = error_code == XS_LOAD_ERROR_INVALID_CODE;
+            }
+            else
+            {
+                is_rejected = error_code == XS_LOAD_OK && vm.xvm_get_script_error(script_index) == XS_RUNTIME_ERROR_INVALID_CODE &&
+                    run_pooled_script(vm, script_index) == -1;
+            }
+            if(script_index != -1)
+            {
+                vm.xvm_unload_script(script_index);
+            }
+
+            sprintf(name, "verifier: %s is rejected(%s)", patch_names[patch], mode_names[mode]);
+            check(is_rejected, name);
+        }
+
+        vm.xvm_shutdown();
+    }
+}
+
+//------------JIT-------------------------------//
+
+//count.xss's loop runs long enough to be compiled. cross-checking replays every native run in the interpreter,
+//the results have to match it and each other. where there's no JIT the mode stays off and the runs are interpreted
+static void test_jit()
+{
+    const char* jit_mode_names[] = { "off", "on", "cross-check" };
+    const char* load_mode_names[] = { "eager", "lazy" };
+    for(int jit_mode = XS_JIT_ON; jit_mode <= XS_JIT_CROSS_CHECK; ++jit_mode)
+    {
+        for(int load_mode = XS_LOAD_EAGER; load_mode <= XS_LOAD_LAZY; ++load_mode)
+        {
+            xvm vm;
+            vm.xvm_init(XS_EXEC_ENGINE_THREADED);
+            vm.xvm_set_load_mode(load_mode);
+            vm.xvm_set_jit_mode(jit_mode);
+
+            char name[64];
+            sprintf(name, "jit: %s, %s load", jit_mode_names[jit_mode], load_mode_names[load_mode]);
+            check(run_counting_scripts(vm, 2) && vm.xvm_get_jit_mismatch_count() == 0, name);
+            vm.xvm_shutdown();
+        }
+    }
+}
+
+int main()
+{
+    test_scheduling();
+    test_pools();
+    test_pool_slots();
+    test_stack_depths();
+    test_verifier();
+    test_jit();
+
+    printf("%d failure(s)\n", failure_count);
+    return failure_count == 0 ? 0 : 1;
+}
@@ -316,7 +316,7 @@ void instruction_set::init_instruction_set()
     // Ret
     iindex = add_instruction ( "Ret", INSTR_RET, 0 );
 
-    // CallHost      FunctionName
+    // CallHost      FunctionName[, ParamCount]
     iindex = add_instruction ( "CallHost", INSTR_CALLHOST, 1 );
     set_operand_type ( iindex, 0, OP_FLAG_TYPE_HOST_API_CALL );
 
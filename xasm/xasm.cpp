@@ -759,8 +759,27 @@ void xasm::second_pass()
                 }
             }
 
+            //a host call may go on with the number of values it takes off the stack
+            token next_token = xlexer.read_next_token();
+            if(current_instruction.operand_code == INSTR_CALLHOST && next_token == TOKEN_TYPE_COMMA)
+            {
+                if(xlexer.read_next_token() != TOKEN_TYPE_INT)
+                {
+                    xlexer.exit_on_code_error(ERROR_MSSG_INVALID_OP);
+                }
+
+                operand param_count;
+                param_count.type = OP_TYPE_INT;
+                param_count.int_literal = atoi(xlexer.get_current_lexeme());
+                param_count.offset_index = 0;
+                code_stream[current_code_index].operands.push_back(param_count);
+                code_stream[current_code_index].operand_count = 2;
+
+                next_token = xlexer.read_next_token();
+            }
+
             //make sure there's no extranous stuff ahead
-            if(xlexer.read_next_token() != TOKEN_TYPE_NEWLINE)
+            if(next_token != TOKEN_TYPE_NEWLINE)
             {
                 xlexer.exit_on_code_error(ERROR_MSSG_INVALID_INPUT);
             }
@@ -791,6 +810,186 @@ void xasm::assembly_source_file()
     first_pass();
     
     second_pass();
+
+    analyze_stack_depth();
+}
+
+//walks a function's code from its entry point, every path has to reach an instruction with the same number
+//of values pushed. returns the most values pushed at once and adds each call with the depth it's made at to calls
+static int get_operand_depth(const code_vector& code_stream, int first_code, int last_code,
+                             const std::vector<function*>& functions, std::vector<std::pair<int, int> >& calls)
+{
+    std::vector<int> depths(last_code - first_code, XSE2_STACK_DEPTH_UNKNOWN);
+    std::vector<int> pending;
+    depths[0] = 0;
+    pending.push_back(first_code);
+
+    int max_depth = 0;
+    while(!pending.empty())
+    {
+        int code_index = pending.back();
+        pending.pop_back();
+
+        const code& current_code = code_stream[code_index];
+        int depth = depths[code_index - first_code];
+        int next_code = code_index + 1;
+        int target_code = -1;
+
+        switch(current_code.operand_code)
+        {
+        case INSTR_PUSH:
+            ++depth;
+            break;
+        case INSTR_POP:
+            --depth;
+            break;
+        case INSTR_CALL:
+        {
+            //the callee's RET takes its parameters off
+            int function_index = current_code.operands[0].function_index;
+            calls.push_back(std::make_pair(function_index, depth));
+            depth -= functions[function_index]->param_count;
+            break;
+        }
+        case INSTR_CALLHOST:
+            if(current_code.operand_count < 2)
+            {
+                return XSE2_STACK_DEPTH_UNKNOWN;
+            }
+            depth -= current_code.operands[1].int_literal;
+            break;
+        case INSTR_RET:
+        case INSTR_EXIT:
+            next_code = -1;
+            break;
+        case INSTR_JMP:
+            next_code = -1;
+            target_code = current_code.operands[0].instruction_index;
+            break;
+        case INSTR_JE:
+        case INSTR_JNE:
+        case INSTR_JG:
+        case INSTR_JL:
+        case INSTR_JGE:
+        case INSTR_JLE:
+            target_code = current_code.operands[2].instruction_index;
+            break;
+        }
+
+        if(depth < 0)
+        {
+            return XSE2_STACK_DEPTH_UNKNOWN;
+        }
+        if(depth > max_depth)
+        {
+            max_depth = depth;
+        }
+
+        int successors[2] = { next_code, target_code };
+        for(int i = 0; i < 2; ++i)
+        {
+            int successor = successors[i];
+            if(successor < 0)
+            {
+                continue;
+            }
+            if(successor < first_code || successor >= last_code)
+            {
+                return XSE2_STACK_DEPTH_UNKNOWN;
+            }
+
+            if(depths[successor - first_code] == XSE2_STACK_DEPTH_UNKNOWN)
+            {
+                depths[successor - first_code] = depth;
+                pending.push_back(successor);
+            }
+            else if(depths[successor - first_code] != depth)
+            {
+                return XSE2_STACK_DEPTH_UNKNOWN;
+            }
+        }
+    }
+
+    return max_depth;
+}
+
+//a function's frame(return address, locals and frame record) plus the most its operands and calls stack on top of it.
+//states are 0 before a function is visited, 1 while its callees are and 2 once its bound is known
+static int get_stack_bound(int function_index, const std::vector<function*>& functions,
+                           const std::vector<std::vector<std::pair<int, int> > >& calls, std::vector<int>& states)
+{
+    function& f = *functions[function_index];
+    if(states[function_index] == 2)
+    {
+        return f.stack_bound;
+    }
+    if(states[function_index] == 1)
+    {
+        //recursion, the depth depends on the data
+        return XSE2_STACK_DEPTH_UNKNOWN;
+    }
+
+    states[function_index] = 1;
+    int peak = f.operand_depth;
+    for(int i = 0; i < calls[function_index].size() && peak != XSE2_STACK_DEPTH_UNKNOWN; ++i)
+    {
+        int callee_bound = get_stack_bound(calls[function_index][i].first, functions, calls, states);
+        if(callee_bound == XSE2_STACK_DEPTH_UNKNOWN)
+        {
+            peak = XSE2_STACK_DEPTH_UNKNOWN;
+        }
+        else if(calls[function_index][i].second + callee_bound > peak)
+        {
+            peak = calls[function_index][i].second + callee_bound;
+        }
+    }
+
+    f.stack_bound = peak == XSE2_STACK_DEPTH_UNKNOWN ? XSE2_STACK_DEPTH_UNKNOWN : f.local_data_size + 2 + peak;
+    states[function_index] = 2;
+    return f.stack_bound;
+}
+
+void xasm::analyze_stack_depth()
+{
+    //functions by index, each one's code runs up to the next entry point
+    std::vector<function*> functions(function_table.size());
+    for(function_map::iterator it = function_table.begin(); it != function_table.end(); ++it)
+    {
+        functions[it->second.index] = &it->second;
+    }
+
+    std::vector<std::vector<std::pair<int, int> > > calls(functions.size());
+    for(int i = 0; i < functions.size(); ++i)
+    {
+        function& f = *functions[i];
+        int code_end = code_stream.size();
+        for(int j = 0; j < functions.size(); ++j)
+        {
+            if(functions[j]->entry_point > f.entry_point && functions[j]->entry_point < code_end)
+            {
+                code_end = functions[j]->entry_point;
+            }
+        }
+
+        f.operand_depth = get_operand_depth(code_stream, f.entry_point, code_end, functions, calls[i]);
+    }
+
+    std::vector<int> states(functions.size(), 0);
+    for(int i = 0; i < functions.size(); ++i)
+    {
+        get_stack_bound(i, functions, calls, states);
+    }
+
+    //_Main's frame has no return address
+    program_stack_bound = XSE2_STACK_DEPTH_UNKNOWN;
+    if(xscript_header.is_main_function_present)
+    {
+        function& main_function = *functions[xscript_header.main_function_index];
+        if(main_function.stack_bound != XSE2_STACK_DEPTH_UNKNOWN)
+        {
+            program_stack_bound = xscript_header.global_data_size + main_function.stack_bound - 1;
+        }
+    }
 }
 
 void xasm::print_assembly_status()
@@ -823,6 +1022,13 @@ void xasm::print_assembly_status()
     else
         printf("Default");
 
+    printf("\n");
+    printf("     Stack Depth Bound: ");
+    if(program_stack_bound != XSE2_STACK_DEPTH_UNKNOWN)
+        printf("%d", program_stack_bound);
+    else
+        printf("Unknown");
+
     printf("\n");
     printf("              Priority: ");
     switch(xscript_header.priority_type)
@@ -876,6 +1082,20 @@ void xasm::dump_code_stream()
     printf("--------------------START DUMP----------------\n");
 }
 
+//appends a section's records to the image at the next aligned offset and fills in its table entry
+static void add_xse_section(std::vector<char>& image, xse2_section& section, int type, const void* data, int size, int count)
+{
+    image.resize((image.size() + XSE2_SECTION_ALIGNMENT - 1) & ~(XSE2_SECTION_ALIGNMENT - 1));
+
+    section.type = type;
+    section.offset = image.size();
+    section.size = size;
+    section.count = count;
+    section.crc = xse_crc32(data, size);
+
+    image.insert(image.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+}
+
 void xasm::build_xse()
 {
     //dump_code_stream();
@@ -886,102 +1106,40 @@ void xasm::build_xse()
         xlexer.exit_on_error("Could not open executable file for output");
     }
 
-    //-------------write head-------------//
-    //write the ID string(4 bytes)
-    fwrite(XSE_ID_STRING, 4, 1, execute_file);
-
-    //write the version(1 byte for each component, 2 total)
-    char version_major = VERSION_MAJOR;
-    char version_minor = VERSION_MINOR;
-    fwrite(&version_major, 1, 1, execute_file);
-    fwrite(&version_minor, 1, 1, execute_file);
-
-    //write the stack size(4 bytes)
-    fwrite(&xscript_header.stack_size, 4, 1, execute_file);
-
-    //write the global data size(4 bytes)
-    fwrite(&xscript_header.global_data_size, 4, 1, execute_file);
-
-    //write the _Main() flag(1 byte)
-    char is_main_present = xscript_header.is_main_function_present;
-    fwrite(&is_main_present, 1, 1, execute_file);
-
-    //write the _Main() function index(4 bytes)
-    fwrite(&xscript_header.main_function_index, 4, 1, execute_file);
-
-    //write the priority type(1 byte)
-    char priority_type = xscript_header.priority_type;
-    fwrite(&priority_type, 1, 1, execute_file);
-
-    //write the user-defined priority(4 byte)
-    fwrite(&xscript_header.user_priority, 4, 1, execute_file);
-
-    //---------------write instruction stream-----------------//
-    //write instruction count (4 bytes)
+    //---------------instruction stream-----------------//
+    //one fixed-width record per instruction, unused operand slots stay zeroed
     int code_stream_size = code_stream.size();
-    fwrite(&code_stream_size, 4, 1, execute_file);
-
-    //write instructions
+    std::vector<xse2_instruction> instructions(code_stream_size);
     for(int i = 0; i < code_stream_size; ++i)
     {
-        //write the opcode(2 bytes)
-        short opcode = code_stream[i].operand_code;
-        fwrite(&opcode, 2, 1, execute_file);
-
-        //write the operand count(1 byte)
-        char opcount = code_stream[i].operand_count;
-        fwrite(&opcount, 1, 1, execute_file);
+        xse2_instruction& instruction = instructions[i];
+        instruction.opcode = code_stream[i].operand_code;
+        instruction.opcount = code_stream[i].operand_count;
 
-        //write operand list
-        for(int m = 0; m < opcount; ++m)
+        for(int m = 0; m < instruction.opcount; ++m)
         {
-            operand current_operand = code_stream[i].operands[m];
-            
-            //write operand type
-            char op_type = current_operand.type;
-            fwrite(&op_type, 1, 1, execute_file);
-
-            //write the operand depending on its type
-            switch(current_operand.type)
+            operand& current_operand = code_stream[i].operands[m];
+            xse2_operand& op = instruction.oplist[m];
+            op.type = current_operand.type;
+
+            //every operand kind shares the union, only float literals need their own member
+            if(current_operand.type == OP_TYPE_FLOAT)
             {
-            case OP_TYPE_INT:
-                fwrite(&current_operand.int_literal, sizeof(int), 1, execute_file);
-                break;
-            case OP_TYPE_FLOAT:
-                fwrite(&current_operand.float_literal, sizeof(float), 1, execute_file);
-                break;
-            case OP_TYPE_STRING_INDEX:
-                fwrite(&current_operand.string_table_index, sizeof(int), 1, execute_file);
-                break;
-            case OP_TYPE_INSTR_INDEX:
-                fwrite(&current_operand.instruction_index, sizeof(int), 1, execute_file);
-                break;
-            case OP_TYPE_ABS_STACK_INDEX:
-                fwrite(&current_operand.stack_index, sizeof(int), 1, execute_file);
-                break;
-            case OP_TYPE_REL_STACK_INDEX:
-                fwrite(&current_operand.stack_index, sizeof(int), 1, execute_file);
-                fwrite(&current_operand.offset_index, sizeof(int), 1, execute_file);
-                break;
-            case OP_TYPE_FUNC_INDEX:
-                fwrite(&current_operand.function_index, sizeof(int), 1, execute_file);
-                break;
-            case OP_TYPE_HOST_API_CALL_INDEX:
-                fwrite(&current_operand.host_api_index, sizeof(int), 1, execute_file);
-                break;
-            case OP_TYPE_REG:
-                fwrite(&current_operand.reg, sizeof(int), 1, execute_file);
-                break;
+                op.float_literal = current_operand.float_literal;
+            }
+            else
+            {
+                op.int_literal = current_operand.int_literal;
+            }
+            if(current_operand.type == OP_TYPE_REL_STACK_INDEX)
+            {
+                op.offset_index = current_operand.offset_index;
             }
         }
     }
 
     //----------------string table--------------//
-    //write out the string count(4 bytes)
-    int string_table_size = string_table.size();
-    fwrite(&string_table_size, 4, 1, execute_file);
-
-    //write string by string_index order
+    //literals by string_index order, then the function and host API names
     std::vector<string> string_vector;
     string_vector.resize(string_table.size());
     for(string_map::iterator it = string_table.begin(); it != string_table.end(); ++it)
@@ -989,72 +1147,100 @@ void xasm::build_xse()
         assert(it->second < string_vector.size());
         string_vector[it->second] = it->first;
     }
-    for(int i = 0; i < string_vector.size(); ++i)
-    {
-        //write the string length(4 bytes), followd by the string data
-        int slen = string_vector[i].size();
-        fwrite(&slen, 4, 1, execute_file);
-        fwrite(string_vector[i].c_str(), slen, 1, execute_file);
-    }
+    int string_literal_count = string_vector.size();
 
     //----------------function table--------------//
-    //write out the function count(4 bytes)
-    int function_table_size = function_table.size();
-    fwrite(&function_table_size, 4, 1, execute_file);
-
     //write function by function_index order
-    std::vector<function> function_vector;
+    std::vector<xse2_function> function_vector;
     function_vector.resize(function_table.size());
     for(function_map::iterator it = function_table.begin(); it != function_table.end(); ++it)
     {
-        assert(it->second.index < function_vector.size());
-        function_vector[it->second.index] = it->second;
+        function& f = it->second;
+        assert(f.index < function_vector.size());
+
+        xse2_function& record = function_vector[f.index];
+        record.entry_point = f.entry_point;
+        record.param_count = f.param_count;
+        record.local_data_size = f.local_data_size;
+        record.name_index = string_vector.size();
+        string_vector.push_back(f.name);
     }
-    for(int i = 0; i < function_vector.size(); ++i)
-    {
-        function& f = function_vector[i];
-
-        //write the entry point(4 bytes)
-        fwrite(&(f.entry_point), 4, 1, execute_file);
 
-        //write the parameter count(1 byte)
-        char param_count = f.param_count;
-        fwrite(&param_count, 1, 1, execute_file);
-
-        //write the local data size(4 bytes)
-        fwrite(&(f.local_data_size), 4, 1, execute_file);
-
-        //write the function name length(1 byte)
-        char function_name_length = f.name.size();
-        fwrite(&function_name_length, 1, 1, execute_file);
-
-        //write the function name(N bytes)
-        fwrite(f.name.c_str(), f.name.size(), 1, execute_file);
+    //----------------stack depths--------------//
+    //by function_index order, then the whole program
+    std::vector<xse2_stack_depth> stack_depth_vector(function_table.size() + 1);
+    for(function_map::iterator it = function_table.begin(); it != function_table.end(); ++it)
+    {
+        stack_depth_vector[it->second.index].operand_depth = it->second.operand_depth;
+        stack_depth_vector[it->second.index].stack_bound = it->second.stack_bound;
     }
+    stack_depth_vector[function_table.size()].operand_depth = 0;
+    stack_depth_vector[function_table.size()].stack_bound = program_stack_bound;
 
     //----------------host api table--------------//
-    //write out the call count(4 bytes)
-    int host_api_table_size = host_api_table.size();
-    fwrite(&host_api_table_size, 4, 1, execute_file);
-
     //write host api by host_api_index order
-    std::vector<string> host_api_vector;
+    std::vector<int> host_api_vector;
     host_api_vector.resize(host_api_table.size());
     for(string_map::iterator it = host_api_table.begin(); it != host_api_table.end(); ++it)
     {
         assert(it->second < host_api_vector.size());
-        host_api_vector[it->second] = it->first;
+        host_api_vector[it->second] = string_vector.size();
+        string_vector.push_back(it->first);
     }
-    for(int i = 0; i < host_api_vector.size(); ++i)
-    {
-        char slen = static_cast<char>(host_api_vector[i].size());
 
-        //write the length(1 byte), followed by the string data
-        fwrite(&slen, 1, 1, execute_file);
-        fwrite(host_api_vector[i].c_str(), slen, 1, execute_file);
+    //lay the strings out back to back with null terminators, the offset array has one extra entry for the end
+    std::vector<unsigned int> string_offsets;
+    std::string string_data;
+    for(int i = 0; i < string_vector.size(); ++i)
+    {
+        string_offsets.push_back(string_data.size());
+        string_data += string_vector[i];
+        string_data += '\0';
+    }
+    string_offsets.push_back(string_data.size());
+
+    //-------------header and sections-------------//
+    xse2_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.id, XSE2_ID_STRING, 4);
+    header.major_version = XSE2_MAJOR_VERSION;
+    header.minor_version = XSE2_MINOR_VERSION;
+    header.section_count = XSE2_SECTION_COUNT;
+    header.stack_size = xscript_header.stack_size;
+    header.global_data_size = xscript_header.global_data_size;
+    header.is_main_function_present = xscript_header.is_main_function_present;
+    header.main_function_index = xscript_header.main_function_index;
+    header.priority_type = xscript_header.priority_type;
+    header.timeslice_duration = xscript_header.user_priority;
+    header.string_literal_count = string_literal_count;
+
+    //the header and section table come first, the sections follow in type order
+    xse2_section sections[XSE2_SECTION_COUNT];
+    std::vector<char> image(sizeof(header) + sizeof(sections));
+    add_xse_section(image, sections[XSE2_SECTION_CODE], XSE2_SECTION_CODE,
+        instructions.data(), instructions.size() * sizeof(xse2_instruction), instructions.size());
+    add_xse_section(image, sections[XSE2_SECTION_STRING_OFFSETS], XSE2_SECTION_STRING_OFFSETS,
+        string_offsets.data(), string_offsets.size() * sizeof(unsigned int), string_offsets.size());
+    add_xse_section(image, sections[XSE2_SECTION_STRING_DATA], XSE2_SECTION_STRING_DATA,
+        string_data.data(), string_data.size(), string_vector.size());
+    add_xse_section(image, sections[XSE2_SECTION_FUNCTIONS], XSE2_SECTION_FUNCTIONS,
+        function_vector.data(), function_vector.size() * sizeof(xse2_function), function_vector.size());
+    add_xse_section(image, sections[XSE2_SECTION_HOST_APIS], XSE2_SECTION_HOST_APIS,
+        host_api_vector.data(), host_api_vector.size() * sizeof(int), host_api_vector.size());
+    add_xse_section(image, sections[XSE2_SECTION_STACK_DEPTHS], XSE2_SECTION_STACK_DEPTHS,
+        stack_depth_vector.data(), stack_depth_vector.size() * sizeof(xse2_stack_depth), stack_depth_vector.size());
+
+    memcpy(&image[sizeof(header)], sections, sizeof(sections));
+    memcpy(&image[0], &header, sizeof(header));
+    header.crc = xse_crc32(&image[0], sizeof(header) + sizeof(sections));
+    memcpy(&image[0], &header, sizeof(header));
+
+    //write the whole executable at once and close the file
+    if(fwrite(&image[0], image.size(), 1, execute_file) != 1)
+    {
+        fclose(execute_file);
+        xlexer.exit_on_error("Could not write executable file");
     }
-
-    //close file
     fclose(execute_file);
 }
 
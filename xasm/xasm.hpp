@@ -9,6 +9,7 @@
 #include "instruction_set.hpp"
 #include "lexer.hpp"
 #include "error_code.hpp"
+#include "../common/xse_format.hpp"
 
 using std::string;
 
@@ -19,8 +20,7 @@ namespace xasm {
 #define     SOURCE_FILE_EXT     ".XASM"//extension of a source code file
 #define     EXEC_FILE_EXT       ".XSE"//extension of an executable code file
 
-//version
-#define     XSE_ID_STRING       "XSE0"//written to the file to state it's validity
+//assembler version, the executable format has its own in xse_format.hpp
 #define     VERSION_MAJOR       0
 #define     VERSION_MINOR       8
 
@@ -87,6 +87,10 @@ struct function
     int entry_point;
     int param_count;
     int local_data_size;
+
+    //filled in by analyze_stack_depth, XSE2_STACK_DEPTH_UNKNOWN if they can't be worked out
+    int operand_depth;
+    int stack_bound;
 };
 
 struct label
@@ -129,6 +133,7 @@ public:
     void first_pass();
     void second_pass();
     void assembly_source_file();
+    void analyze_stack_depth();
     void build_xse();
 
     void print_assembly_status();
@@ -166,6 +171,7 @@ private:
 
     //script header
     script_header xscript_header;
+    int program_stack_bound;//slots the whole program needs, XSE2_STACK_DEPTH_UNKNOWN if it may recurse
 
     //instruction stream
     code_vector code_stream;
@@ -1190,6 +1190,11 @@ void parser::parse_function_call()
     int instruction = f->is_host_api ? INSTR_CALLHOST : INSTR_CALL;
     int ii = xicode.add_icode_instruction(current_scope, instruction);
     xicode.add_function_icode_op(current_scope, ii, f->index);
+    if(f->is_host_api)
+    {
+        //the host takes its parameters off, the assembler needs to know how many to work out stack depths
+        xicode.add_int_icode_op(current_scope, ii, param_count);
+    }
 }
 
 }//namespace xcomplier
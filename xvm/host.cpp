@@ -2,19 +2,17 @@
 #include "xvm.hpp"
 #include "../common/utility.hpp"
 
-xscript::xvm::xvm vm;
-
-void host_api_print_string(int script_index)
+void host_api_print_string(xscript::xvm::xvm_interface* vm, int script_index, void* user_data)
 {
-    string s = vm.xvm_get_param_as_string(script_index, 0);
-    int count = vm.xvm_get_param_as_int(script_index, 1);
+    string s = vm->xvm_get_param_as_string(script_index, 0);
+    int count = vm->xvm_get_param_as_int(script_index, 1);
 
     for(int i = 0; i < count; ++i)
     {
         printf("\t%s\n", s.c_str());
     }
 
-    vm.xvm_return_string_from_host(script_index, 2, "this is a return value.");
+    vm->xvm_return_string_from_host(script_index, 2, "this is a return value.");
 }
 
 main()
@@ -23,6 +21,7 @@ main()
     printf("XScript Virtual Machine\n");
     printf("\n");
 
+    xscript::xvm::xvm vm;
     vm.xvm_init();
 
     int script_index;
@@ -48,6 +47,9 @@ main()
         case XS_LOAD_ERROR_OUT_OF_THREADS:
             printf("Out of threads");
             break;
+        case XS_LOAD_ERROR_INVALID_CODE:
+            printf("Invalid code");
+            break;
         }
         printf("\n");
 
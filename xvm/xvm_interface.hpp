@@ -14,6 +14,16 @@ enum SCRIPT_LOAD_ERROR_CODE
     XS_LOAD_ERROR_UNSUPPORTED_VERS,
     XS_LOAD_ERROR_OUT_OF_MEMORY,
     XS_LOAD_ERROR_OUT_OF_THREADS,
+    XS_LOAD_ERROR_INVALID_CODE,//the code failed the load-time verification
+};
+
+enum SCRIPT_RUNTIME_ERROR_CODE
+{
+    XS_RUNTIME_OK = 0,
+    XS_RUNTIME_ERROR_STACK_OVERFLOW,//a call or push needed more stack than the executable allows
+    XS_RUNTIME_ERROR_STACK_UNDERFLOW,//code the verifier couldn't follow took more values off the stack than it pushed
+    XS_RUNTIME_ERROR_INDEX_OUT_OF_RANGE,//an array index left the stack in use
+    XS_RUNTIME_ERROR_INVALID_CODE,//a lazily loaded function failed the verification when it was first called
 };
 
 enum THREAD_PRIORITY
@@ -25,7 +35,56 @@ enum THREAD_PRIORITY
     XS_THREAD_PRIORITY_HIGH, 
 };
 
-typedef void(*host_api_function_ptr)(int thread_index);//host API function pointer alias 
+enum EXEC_ENGINE
+{
+    XS_EXEC_ENGINE_SWITCH = 0,//the reference switch(opcode) loop
+    XS_EXEC_ENGINE_THREADED,//pre-decoded, direct-threaded(computed goto) dispatch
+};
+
+enum JIT_MODE
+{
+    XS_JIT_OFF = 0,
+    XS_JIT_ON,//compile hot functions to native code(threaded engine only)
+    XS_JIT_CROSS_CHECK,//also replay every native run in the interpreter and compare the results
+};
+
+enum TIMESLICE_MODE
+{
+    XS_TIMESLICE_CLOCK = 0,//timeslices are measured with the system clock
+    XS_TIMESLICE_FUEL,//timeslices are instruction budgets, the clock is only read when one runs out
+};
+
+enum LOAD_MODE
+{
+    XS_LOAD_EAGER = 0,//decode the whole executable when it is loaded
+    XS_LOAD_LAZY,//decode each function on its first call, v0.8 executables are always decoded eagerly
+};
+
+enum IDLE_MODE
+{
+    XS_IDLE_BLOCK = 0,//xvm_run_script sleeps until a script wakes up or its timeslice is over
+    XS_IDLE_RETURN,//xvm_run_script returns as soon as every script is sleeping
+};
+
+//string table garbage collection statistics, summed over all scripts
+struct xvm_gc_stats
+{
+    int collection_count;
+    int strings_reclaimed;
+    long long bytes_reclaimed;
+    long long total_pause_us;
+    int last_pause_us;
+    int max_pause_us;
+};
+
+namespace xscript {
+namespace xvm {
+class xvm_interface;
+}//namespace xvm
+}//namespace xscript
+
+//host API function pointer alias, called with the VM running the script and the user data it was registered with
+typedef void(*host_api_function_ptr)(xscript::xvm::xvm_interface* vm, int script_index, void* user_data);
 
 namespace xscript {
 namespace xvm {
@@ -34,12 +93,26 @@ class xvm_interface
 {
 public:
     //------------script interface----------//
-    virtual void xvm_init() = 0;
+    virtual void xvm_init(int engine = XS_EXEC_ENGINE_THREADED) = 0;
     virtual void xvm_shutdown() = 0;
     
+    //a file with instances still loaded isn't read again, the new instance shares their code
     virtual int xvm_load_script(const char* script_name, int& script_index, int thread_timeslice) = 0;
+    virtual void xvm_set_load_mode(int mode) = 0;
     virtual void xvm_unload_script(int script_index) = 0;
     virtual void xvm_reset_script(int script_index) = 0;
+    //the error that stopped the script, XS_RUNTIME_OK if there is none
+    virtual int xvm_get_script_error(int script_index) = 0;
+
+    //a pool keeps instances of an executable loaded and reset, so a script can be handed out and started
+    //without loading it. acquire returns a stopped, freshly reset instance(loading another one when every
+    //instance is taken, -1 if that fails) and release resets it and puts it back, releasing an idle instance does nothing.
+    //unloading an idle instance takes it out of its pool. a destroyed pool unloads
+    //its idle instances at once and the others when they're released. like loading, only the host's thread may use these
+    virtual int xvm_create_script_pool(const char* script_name, int instance_count, int thread_timeslice, int& pool_index) = 0;
+    virtual void xvm_destroy_script_pool(int pool_index) = 0;
+    virtual int xvm_acquire_script(int pool_index) = 0;
+    virtual void xvm_release_script(int script_index) = 0;
 
     virtual void xvm_run_script(int timeslice_duration) = 0;
 
@@ -59,8 +132,21 @@ public:
     virtual void xvm_call_script_function(int script_index, const char* fname) = 0;
     virtual void xvm_invoke_script_function(int script_index, const char* fname) = 0;
 
+    virtual void xvm_set_jit_mode(int mode) = 0;
+    virtual int xvm_get_jit_mismatch_count() = 0;
+
+    virtual void xvm_set_timeslice_mode(int mode) = 0;
+    //runs scripts on this many OS threads, host functions may then be called from several threads at once
+    //and must not load or unload scripts
+    virtual void xvm_set_worker_count(int count) = 0;
+    virtual void xvm_set_idle_mode(int mode) = 0;
+    virtual int xvm_get_sleep_time() = 0;
+
+    virtual void xvm_set_string_gc_thresholds(int min_string_count, int growth_percent) = 0;
+    virtual void xvm_get_string_gc_stats(xvm_gc_stats& stats) = 0;
+
     //------------host API interface----------------//
-    virtual void xvm_register_host_api(int script_index, const char* fname, host_api_function_ptr fn) = 0;
+    virtual void xvm_register_host_api(int script_index, const char* fname, host_api_function_ptr fn, void* user_data = NULL) = 0;
 
     virtual int xvm_get_param_as_int(int script_index, int param_index) = 0;
     virtual float xvm_get_param_as_float(int script_index, int param_index) = 0;
@@ -0,0 +1,632 @@
+#include "xvm.hpp"
+
+#include <map>
+#include <sys/mman.h>
+
+namespace xscript {
+namespace xvm {
+
+#if XVM_HAS_JIT
+
+//register assignment inside compiled code:
+//  rdi  jit_context*       r8   stack elements      r9   frame index
+//  r10  stack top          r11  _RetVal pointer     rax  scratch
+//none of them are callee-saved and compiled code never calls out, so there is no frame to set up
+enum JIT_REGISTER
+{
+    REG_RAX = 0,
+    REG_RCX = 1,
+    REG_RSI = 6,
+    REG_RDI = 7,
+    REG_R8 = 8,
+    REG_R9 = 9,
+    REG_R10 = 10,
+    REG_R11 = 11,
+};
+
+//x86-64 opcodes, two byte opcodes keep their 0x0f prefix in the high byte
+#define     X86_ADD_RM_R        0x01
+#define     X86_SUB_RM_R        0x29
+#define     X86_CMP_R_RM        0x3b
+#define     X86_CMP_EAX_IMM     0x3d
+#define     X86_IMUL_R_RM_IMM   0x69
+#define     X86_GROUP1_RM_IMM   0x81//extension: /0 add, /5 sub, /7 cmp
+#define     X86_GROUP1_RM_IMM8  0x83
+#define     X86_MOV_RM_R        0x89
+#define     X86_MOV_R_RM        0x8b
+#define     X86_MOVSXD_R_RM     0x63
+#define     X86_MOV_EAX_IMM     0xb8
+#define     X86_RET             0xc3
+#define     X86_JMP_REL32       0xe9
+#define     X86_GROUP5_RM       0xff//extension: /0 inc, /1 dec, /4 jmp
+#define     X86_IMUL_R_RM       0x0faf
+#define     X86_JE_REL32        0x0f84
+#define     X86_JNE_REL32       0x0f85
+#define     X86_JG_REL32        0x0f8f
+#define     X86_JL_REL32        0x0f8c
+#define     X86_JGE_REL32       0x0f8d
+#define     X86_JLE_REL32       0x0f8e//jcc opcodes come in pairs, (opcode ^ 1) is the inverse condition
+
+#define     X86_EXT_ADD         0
+#define     X86_EXT_DEC         1
+#define     X86_EXT_SUB         5
+#define     X86_EXT_CMP         7
+
+//memory operand [base + index * 8 + disp]
+struct jit_mem
+{
+    int base;
+    int index;//-1 when unused
+    int disp;
+};
+
+static jit_mem context_mem(int offset)
+{
+    jit_mem m = { REG_RDI, -1, offset };
+    return m;
+}
+
+//absolute stack index, negative indices are relative to the frame
+static jit_mem stack_mem(int stack_index, int offset)
+{
+    jit_mem m = { REG_R8, stack_index < 0 ? REG_R9 : -1, stack_index * (int)sizeof(xvm_value) + offset };
+    return m;
+}
+
+static jit_mem top_mem(int offset)
+{
+    jit_mem m = { REG_R8, REG_R10, offset };
+    return m;
+}
+
+static jit_mem ret_val_mem(int offset)
+{
+    jit_mem m = { REG_R11, -1, offset };
+    return m;
+}
+
+#define     TYPE_OFFSET         0
+#define     PAYLOAD_OFFSET      4
+
+class jit_assembler
+{
+public:
+    void byte(int b)
+    {
+        bytes.push_back(static_cast<unsigned char>(b));
+    }
+
+    void imm32(int v)
+    {
+        for(int i = 0; i < 4; ++i)
+        {
+            byte(v >> (i * 8));
+        }
+    }
+
+    int offset() const
+    {
+        return bytes.size();
+    }
+
+    //[rex] opcode modrm [sib] disp32, reg is a register or an opcode extension
+    void op_mem(int opcode, int reg, const jit_mem& m, bool is_wide)
+    {
+        int rex = (is_wide ? 8 : 0) | (reg & 8 ? 4 : 0) | (m.index >= 0 && (m.index & 8) ? 2 : 0) | (m.base & 8 ? 1 : 0);
+        if(rex)
+        {
+            byte(0x40 | rex);
+        }
+
+        if(opcode > 0xff)
+        {
+            byte(opcode >> 8);
+        }
+        byte(opcode);
+
+        if(m.index >= 0)
+        {
+            byte(0x80 | ((reg & 7) << 3) | 4);
+            byte(0xc0 | ((m.index & 7) << 3) | (m.base & 7));
+        }
+        else
+        {
+            byte(0x80 | ((reg & 7) << 3) | (m.base & 7));
+        }
+        imm32(m.disp);
+    }
+
+    //move a whole 8 byte value from one slot to another through rax
+    void copy_value(const jit_mem& dest, const jit_mem& source)
+    {
+        op_mem(X86_MOV_R_RM, REG_RAX, source, true);
+        op_mem(X86_MOV_RM_R, REG_RAX, dest, true);
+    }
+
+    void store_literal(const jit_mem& dest, const xvm_value& v)
+    {
+        unsigned long long bits;
+        memcpy(&bits, &v, sizeof(bits));
+
+        //mov rax, imm64
+        byte(0x48);
+        byte(0xb8);
+        imm32(static_cast<int>(bits));
+        imm32(static_cast<int>(bits >> 32));
+        op_mem(X86_MOV_RM_R, REG_RAX, dest, true);
+    }
+
+    //inc r10 / dec r10
+    void adjust_top(bool is_push)
+    {
+        byte(0x49);
+        byte(0xff);
+        byte(is_push ? 0xc2 : 0xca);
+    }
+
+    //emits a jump with a rel32 to be patched and returns the patch location
+    int jump(int opcode)
+    {
+        if(opcode > 0xff)
+        {
+            byte(opcode >> 8);
+        }
+        byte(opcode);
+        imm32(0);
+
+        return offset() - 4;
+    }
+
+    void patch(int at, int target)
+    {
+        int rel = target - (at + 4);
+        memcpy(&bytes[at], &rel, 4);
+    }
+
+    std::vector<unsigned char> bytes;
+};
+
+//jump targets waiting for the instruction or exit stub they point to
+typedef std::vector<int> patch_vector;
+typedef std::map<int, patch_vector> patch_map;
+
+struct jit_function_builder
+{
+    jit_assembler a;
+    int first_code;
+    int last_code;
+    bool is_counting_steps;
+    bool is_stack_proven;//the interpreter hands out the function's whole operand depth on CALL
+    int fused_end;//instructions before this belong to a fused sequence, counted as one step at its head
+
+    patch_map label_patches;//by instruction index
+    patch_map exit_patches;//by the instruction index the interpreter resumes at
+
+    void exit_to(int opcode, int code_index)
+    {
+        exit_patches[code_index].push_back(a.jump(opcode));
+    }
+
+    void count_step(int code_index)
+    {
+        if(is_counting_steps && code_index >= fused_end)
+        {
+            a.op_mem(X86_GROUP5_RM, 0, context_mem(offsetof(jit_context, steps)), false);
+        }
+    }
+
+    //bail out to the interpreter at code_index unless the slot holds an integer
+    void guard_int(const jit_mem& slot, int code_index)
+    {
+        a.op_mem(X86_GROUP1_RM_IMM, X86_EXT_CMP, slot, false);
+        a.imm32(OP_TYPE_INT);
+        exit_to(X86_JNE_REL32, code_index);
+    }
+
+    //bail out to the interpreter at code_index unless slot_count(one or two) values can be pushed
+    void guard_push(int slot_count, int code_index)
+    {
+        if(is_stack_proven)
+        {
+            return;
+        }
+
+        a.op_mem(X86_CMP_R_RM, REG_R10, context_mem(offsetof(jit_context, push_limit)), false);
+        exit_to(slot_count > 1 ? X86_JGE_REL32 : X86_JG_REL32, code_index);
+    }
+
+    //bail out to the interpreter at code_index, which raises the error, if a pop would take a value under the frame
+    void guard_pop(int code_index)
+    {
+        if(is_stack_proven)
+        {
+            return;
+        }
+
+        a.op_mem(X86_CMP_R_RM, REG_R10, context_mem(offsetof(jit_context, frame)), false);
+        exit_to(X86_JLE_REL32, code_index);
+    }
+
+    //opcode is a jcc(or jmp) taken towards target
+    void branch(int opcode, int code_index, int target)
+    {
+        if(target < first_code || target >= last_code)
+        {
+            exit_to(opcode, target);
+            return;
+        }
+
+        if(target > code_index)
+        {
+            label_patches[target].push_back(a.jump(opcode));
+            return;
+        }
+
+        //back edges spend the budget so long loops still return to the scheduler
+        int skip = -1;
+        if(opcode != X86_JMP_REL32)
+        {
+            skip = a.jump(opcode ^ 1);
+        }
+        a.op_mem(X86_GROUP1_RM_IMM8, X86_EXT_SUB, context_mem(offsetof(jit_context, budget)), false);
+        a.byte(1);
+        exit_to(X86_JLE_REL32, target);
+        label_patches[target].push_back(a.jump(X86_JMP_REL32));
+        if(skip >= 0)
+        {
+            a.patch(skip, a.offset());
+        }
+    }
+
+    bool emit(const xvm_code& code, int code_index);
+};
+
+//jcc opcodes for JE..JLE
+static const int JUMP_CONDITIONS[] = { X86_JE_REL32, X86_JNE_REL32, X86_JG_REL32, X86_JL_REL32, X86_JGE_REL32, X86_JLE_REL32 };
+
+bool jit_function_builder::emit(const xvm_code& code, int code_index)
+{
+    const xvm_operand* op = code.oplist;
+
+    //the interpreter runs a superinstruction as one step. its head keeps the quickened form of the
+    //original instruction and the rest of the sequence is still in place, so compile the sequence
+    //instruction by instruction but count it once, after checking up front that the comparison
+    //can't bail out half way through
+    if(code.opcode >= INSTR_SUPER_FIRST && code.opcode <= INSTR_SUPER_LAST)
+    {
+        int length = SUPER_INSTRUCTION_LENGTH[code.opcode - INSTR_SUPER_FIRST];
+        for(int i = 0; i < length; ++i)
+        {
+            if((&code)[i].quick_opcode == QINSTR_NONE && (&code)[i].opcode != INSTR_JMP)
+            {
+                exit_to(X86_JMP_REL32, code_index);
+                return false;
+            }
+        }
+
+        if(code.opcode == INSTR_CMP_PUSH || code.opcode == INSTR_CMP_BRANCH)
+        {
+            switch(code.quick_opcode)
+            {
+            case QINSTR_PUSH_STACK:
+                guard_int(stack_mem(op[0].stack_index, TYPE_OFFSET), code_index);
+                break;
+            case QINSTR_PUSH_REG:
+                guard_int(ret_val_mem(TYPE_OFFSET), code_index);
+                break;
+            case QINSTR_PUSH_LITERAL:
+                if(op[0].type == OP_TYPE_INT)
+                {
+                    break;
+                }
+                //fall through
+            default:
+                exit_to(X86_JMP_REL32, code_index);
+                return false;
+            }
+        }
+
+        //every sequence starts with a push and never holds more than two values above the top
+        guard_push(2, code_index);
+        count_step(code_index);
+        fused_end = code_index + length;
+    }
+
+    switch(code.quick_opcode)
+    {
+    case QINSTR_MOV_STACK_STACK:
+        a.copy_value(stack_mem(op[0].stack_index, 0), stack_mem(op[1].stack_index, 0));
+        break;
+    case QINSTR_MOV_STACK_LITERAL:
+        a.store_literal(stack_mem(op[0].stack_index, 0), op[1]);
+        break;
+    case QINSTR_MOV_STACK_REG:
+        a.copy_value(stack_mem(op[0].stack_index, 0), ret_val_mem(0));
+        break;
+    case QINSTR_MOV_REG_STACK:
+        a.copy_value(ret_val_mem(0), stack_mem(op[1].stack_index, 0));
+        break;
+
+    case QINSTR_ADD_STACK_STACK:
+    case QINSTR_SUB_STACK_STACK:
+    case QINSTR_MUL_STACK_STACK:
+    {
+        jit_mem dest = stack_mem(op[0].stack_index, PAYLOAD_OFFSET);
+        jit_mem source = stack_mem(op[1].stack_index, PAYLOAD_OFFSET);
+        guard_int(stack_mem(op[0].stack_index, TYPE_OFFSET), code_index);
+        guard_int(stack_mem(op[1].stack_index, TYPE_OFFSET), code_index);
+
+        if(code.quick_opcode == QINSTR_MUL_STACK_STACK)
+        {
+            a.op_mem(X86_MOV_R_RM, REG_RAX, dest, false);
+            a.op_mem(X86_IMUL_R_RM, REG_RAX, source, false);
+            a.op_mem(X86_MOV_RM_R, REG_RAX, dest, false);
+        }
+        else
+        {
+            a.op_mem(X86_MOV_R_RM, REG_RAX, source, false);
+            a.op_mem(code.quick_opcode == QINSTR_ADD_STACK_STACK ? X86_ADD_RM_R : X86_SUB_RM_R, REG_RAX, dest, false);
+        }
+        break;
+    }
+    case QINSTR_ADD_STACK_INT:
+    case QINSTR_SUB_STACK_INT:
+    case QINSTR_MUL_STACK_INT:
+    {
+        jit_mem dest = stack_mem(op[0].stack_index, PAYLOAD_OFFSET);
+        guard_int(stack_mem(op[0].stack_index, TYPE_OFFSET), code_index);
+
+        if(code.quick_opcode == QINSTR_MUL_STACK_INT)
+        {
+            a.op_mem(X86_IMUL_R_RM_IMM, REG_RAX, dest, false);
+            a.imm32(op[1].int_literal);
+            a.op_mem(X86_MOV_RM_R, REG_RAX, dest, false);
+        }
+        else
+        {
+            a.op_mem(X86_GROUP1_RM_IMM, code.quick_opcode == QINSTR_ADD_STACK_INT ? X86_EXT_ADD : X86_EXT_SUB, dest, false);
+            a.imm32(op[1].int_literal);
+        }
+        break;
+    }
+    case QINSTR_INC_STACK:
+    case QINSTR_DEC_STACK:
+        guard_int(stack_mem(op[0].stack_index, TYPE_OFFSET), code_index);
+        a.op_mem(X86_GROUP1_RM_IMM, code.quick_opcode == QINSTR_INC_STACK ? X86_EXT_ADD : X86_EXT_SUB,
+            stack_mem(op[0].stack_index, PAYLOAD_OFFSET), false);
+        a.imm32(1);
+        break;
+
+    case QINSTR_JE_STACK_STACK:
+    case QINSTR_JE_STACK_INT:
+    case QINSTR_JNE_STACK_STACK:
+    case QINSTR_JNE_STACK_INT:
+    case QINSTR_JG_STACK_STACK:
+    case QINSTR_JG_STACK_INT:
+    case QINSTR_JL_STACK_STACK:
+    case QINSTR_JL_STACK_INT:
+    case QINSTR_JGE_STACK_STACK:
+    case QINSTR_JGE_STACK_INT:
+    case QINSTR_JLE_STACK_STACK:
+    case QINSTR_JLE_STACK_INT:
+    {
+        //like the interpreter, only the first operand's type decides the comparison
+        bool is_stack_stack = (code.quick_opcode - QINSTR_JE_STACK_STACK) % 2 == 0;
+        guard_int(stack_mem(op[0].stack_index, TYPE_OFFSET), code_index);
+        count_step(code_index);
+
+        a.op_mem(X86_MOV_R_RM, REG_RAX, stack_mem(op[0].stack_index, PAYLOAD_OFFSET), false);
+        if(is_stack_stack)
+        {
+            a.op_mem(X86_CMP_R_RM, REG_RAX, stack_mem(op[1].stack_index, PAYLOAD_OFFSET), false);
+        }
+        else
+        {
+            a.byte(X86_CMP_EAX_IMM);
+            a.imm32(op[1].int_literal);
+        }
+        branch(JUMP_CONDITIONS[code.opcode - INSTR_JE], code_index, op[2].instruction_index);
+        return true;
+    }
+
+    case QINSTR_PUSH_STACK:
+        if(code_index >= fused_end)
+        {
+            guard_push(1, code_index);
+        }
+        a.copy_value(top_mem(0), stack_mem(op[0].stack_index, 0));
+        a.adjust_top(true);
+        break;
+    case QINSTR_PUSH_LITERAL:
+        if(code_index >= fused_end)
+        {
+            guard_push(1, code_index);
+        }
+        a.store_literal(top_mem(0), op[0]);
+        a.adjust_top(true);
+        break;
+    case QINSTR_PUSH_REG:
+        if(code_index >= fused_end)
+        {
+            guard_push(1, code_index);
+        }
+        a.copy_value(top_mem(0), ret_val_mem(0));
+        a.adjust_top(true);
+        break;
+    case QINSTR_POP_STACK:
+        if(code_index >= fused_end)
+        {
+            guard_pop(code_index);
+        }
+        a.adjust_top(false);
+        a.copy_value(stack_mem(op[0].stack_index, 0), top_mem(0));
+        break;
+    case QINSTR_POP_REG:
+        if(code_index >= fused_end)
+        {
+            guard_pop(code_index);
+        }
+        a.adjust_top(false);
+        a.copy_value(ret_val_mem(0), top_mem(0));
+        break;
+
+    default:
+        if(code.opcode == INSTR_JMP)
+        {
+            count_step(code_index);
+            branch(X86_JMP_REL32, code_index, op[0].instruction_index);
+            return true;
+        }
+
+        //not compiled, hand the instruction to the interpreter
+        exit_to(X86_JMP_REL32, code_index);
+        return false;
+    }
+
+    count_step(code_index);
+    return true;
+}
+
+jit_code* jit_compiler::compile(const xvm_code* codes, int first_code, int last_code, bool is_counting_steps, bool is_stack_proven)
+{
+    jit_function_builder b;
+    b.first_code = first_code;
+    b.last_code = last_code;
+    b.is_counting_steps = is_counting_steps;
+    b.is_stack_proven = is_stack_proven;
+    b.fused_end = first_code;
+    jit_assembler& a = b.a;
+
+    jit_code* native = new jit_code;
+    native->first_code = first_code;
+    native->entry_offsets.resize(last_code - first_code);
+
+    //prologue: load the context into registers and jump to the requested instruction(rsi)
+    a.op_mem(X86_MOV_R_RM, REG_R8, context_mem(offsetof(jit_context, elements)), true);
+    a.op_mem(X86_MOV_R_RM, REG_R11, context_mem(offsetof(jit_context, ret_val)), true);
+    a.op_mem(X86_MOVSXD_R_RM, REG_R9, context_mem(offsetof(jit_context, frame)), true);
+    a.op_mem(X86_MOVSXD_R_RM, REG_R10, context_mem(offsetof(jit_context, top)), true);
+    a.byte(0xff);
+    a.byte(0xe6);
+
+    std::vector<bool> is_compiled(last_code - first_code);
+    for(int i = first_code; i < last_code; ++i)
+    {
+        native->entry_offsets[i - first_code] = a.offset();
+        is_compiled[i - first_code] = b.emit(codes[i], i);
+    }
+    b.exit_to(X86_JMP_REL32, last_code);
+
+    //the function entry and every loop header are worth entering from the interpreter
+    std::vector<bool> is_entry(last_code - first_code);
+    is_entry[0] = true;
+    for(int i = first_code; i < last_code; ++i)
+    {
+        const xvm_code& code = codes[i];
+        int target = -1;
+        if(code.opcode == INSTR_JMP)
+        {
+            target = code.oplist[0].instruction_index;
+        }
+        else if(code.opcode >= INSTR_JE && code.opcode <= INSTR_JLE)
+        {
+            target = code.oplist[2].instruction_index;
+        }
+
+        if(target >= first_code && target <= i)
+        {
+            is_entry[target - first_code] = true;
+        }
+    }
+    for(int i = first_code; i < last_code; ++i)
+    {
+        if(is_entry[i - first_code] && is_compiled[i - first_code])
+        {
+            native->entry_points.push_back(i);
+        }
+    }
+
+    for(patch_map::iterator it = b.label_patches.begin(); it != b.label_patches.end(); ++it)
+    {
+        for(int i = 0; i < it->second.size(); ++i)
+        {
+            a.patch(it->second[i], native->entry_offsets[it->first - first_code]);
+        }
+    }
+
+    //exit stubs: eax holds the instruction index to resume at, then the top is written back
+    patch_vector epilogue_patches;
+    for(patch_map::iterator it = b.exit_patches.begin(); it != b.exit_patches.end(); ++it)
+    {
+        for(int i = 0; i < it->second.size(); ++i)
+        {
+            a.patch(it->second[i], a.offset());
+        }
+        a.byte(X86_MOV_EAX_IMM);
+        a.imm32(it->first);
+        epilogue_patches.push_back(a.jump(X86_JMP_REL32));
+    }
+    for(int i = 0; i < epilogue_patches.size(); ++i)
+    {
+        a.patch(epilogue_patches[i], a.offset());
+    }
+    a.op_mem(X86_MOV_RM_R, REG_R10, context_mem(offsetof(jit_context, top)), false);
+    a.byte(X86_RET);
+
+    //copy the code into an executable mapping
+    native->size = a.bytes.size();
+    native->memory = mmap(NULL, native->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(native->memory == MAP_FAILED)
+    {
+        delete native;
+        return NULL;
+    }
+
+    memcpy(native->memory, &a.bytes[0], native->size);
+    if(mprotect(native->memory, native->size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(native->memory, native->size);
+        delete native;
+        return NULL;
+    }
+
+    return native;
+}
+
+void jit_compiler::release(jit_code* native)
+{
+    if(native)
+    {
+        munmap(native->memory, native->size);
+        delete native;
+    }
+}
+
+int jit_compiler::execute(jit_code* native, jit_context* context, int code_index)
+{
+    typedef int (*jit_entry_ptr)(jit_context* context, void* target);
+
+    jit_entry_ptr entry = reinterpret_cast<jit_entry_ptr>(native->memory);
+    return entry(context, static_cast<char*>(native->memory) + native->entry_offsets[code_index - native->first_code]);
+}
+
+#else
+
+jit_code* jit_compiler::compile(const xvm_code* codes, int first_code, int last_code, bool is_counting_steps, bool is_stack_proven)
+{
+    return NULL;
+}
+
+void jit_compiler::release(jit_code* native)
+{
+}
+
+int jit_compiler::execute(jit_code* native, jit_context* context, int code_index)
+{
+    return code_index;
+}
+
+#endif
+
+}//namespace xvm
+}//namespace xscript